@@ -0,0 +1,140 @@
+#ifndef BENCH_HARNESS_H_DEFINED
+#define BENCH_HARNESS_H_DEFINED
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Minimal benchmark harness without external dependencies
+// Every benchmark is a function that performs a batch of work and
+// returns how many operations that batch contained. The harness
+// repeats the batch until a minimum time has passed and reports
+// the best batch, which is the least noisy estimate.
+namespace Bench {
+	struct Result {
+		std::string name;
+		uint64_t operations = 0;
+		uint64_t batches = 0;
+		double seconds = 0;
+		double nsPerOp = 0;
+		double opsPerSecond = 0;
+	};
+
+	typedef std::function<uint64_t()> Batch;
+
+	// Keep the compiler from optimizing a result away
+	template <typename T>
+	inline void doNotOptimize(const T& value)
+	{
+		asm volatile("" : : "r"(&value) : "memory");
+	}
+
+	class Runner {
+	  private:
+		std::vector<Result> results;
+		std::string filter;
+		double minSeconds;
+
+	  public:
+		Runner(const std::string& filter_, double minSeconds_) :
+			filter(filter_),
+			minSeconds(minSeconds_)
+		{}
+		// Run a benchmark if its name contains the filter
+		void run(const std::string& name, const Batch& batch)
+		{
+			if(name.find(filter) == std::string::npos) return;
+			typedef std::chrono::steady_clock Clock;
+			Result r;
+			r.name = name;
+			double best = -1;
+			Clock::time_point start = Clock::now();
+			// At least three batches so the first cold one isn't the only sample
+			while((r.batches < 3) || (std::chrono::duration<double>(Clock::now() - start).count() < minSeconds)) {
+				Clock::time_point t0 = Clock::now();
+				uint64_t ops = batch();
+				double t = std::chrono::duration<double>(Clock::now() - t0).count();
+				r.batches++;
+				if(ops == 0) continue;
+				double perOp = t / ops;
+				if((best < 0) || (perOp < best)) {
+					best = perOp;
+					r.operations = ops;
+					r.seconds = t;
+				}
+			}
+			r.nsPerOp = best * 1e9;
+			r.opsPerSecond = (best > 0) ? (1.0 / best) : 0;
+			fprintf(stderr, "%-48s %12.2f ns/op %14.0f op/s\n", name.c_str(), r.nsPerOp, r.opsPerSecond);
+			results.push_back(r);
+		}
+		inline const std::vector<Result>& getResults() const { return results; };
+		// Write all results as JSON
+		void writeJSON(FILE* f) const
+		{
+			fprintf(f, "{\"benchmarks\":[");
+			for(size_t i = 0; i < results.size(); i++) {
+				const Result& r = results[i];
+				fprintf(f, "%s\n{\"name\":\"%s\",\"operations\":%llu,\"batches\":%llu,\"seconds\":%.9f,\"nsPerOp\":%.4f,\"opsPerSecond\":%.2f}",
+						i ? "," : "", r.name.c_str(), (unsigned long long) r.operations, (unsigned long long) r.batches,
+						r.seconds, r.nsPerOp, r.opsPerSecond);
+			}
+			fprintf(f, "\n]}\n");
+		}
+	};
+
+	// Read the ns/op values of a file previously written by writeJSON
+	inline std::vector<Result> readJSON(const std::string& fileName)
+	{
+		std::vector<Result> R;
+		FILE* f = fopen(fileName.c_str(), "r");
+		if(f == nullptr) {
+			printf("Error: Can't open baseline %s!\n", fileName.c_str());
+			return R;
+		}
+		std::string content;
+		char buffer[4096];
+		size_t n;
+		while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			content.append(buffer, n);
+		fclose(f);
+		size_t pos = 0;
+		while((pos = content.find("\"name\":\"", pos)) != std::string::npos) {
+			pos += 8;
+			size_t end = content.find('"', pos);
+			if(end == std::string::npos) break;
+			Result r;
+			r.name = content.substr(pos, end - pos);
+			size_t ns = content.find("\"nsPerOp\":", end);
+			if(ns == std::string::npos) break;
+			r.nsPerOp = std::stod(content.substr(ns + 10));
+			R.push_back(r);
+			pos = ns;
+		}
+		return R;
+	}
+
+	// Compare against a baseline and list everything that got slower
+	// than the tolerance allows, returns the number of regressions
+	inline unsigned int compare(const std::vector<Result>& current, const std::vector<Result>& baseline, double tolerance)
+	{
+		unsigned int regressions = 0;
+		for(const Result& c : current) {
+			for(const Result& b : baseline) {
+				if((b.name != c.name) || (b.nsPerOp <= 0)) continue;
+				double ratio = c.nsPerOp / b.nsPerOp;
+				if(ratio > 1 + tolerance) {
+					printf("Regression: %s %.2f ns/op -> %.2f ns/op (%+.1f%%)\n",
+						   c.name.c_str(), b.nsPerOp, c.nsPerOp, (ratio - 1) * 100);
+					regressions++;
+				}
+			}
+		}
+		return regressions;
+	}
+}; // namespace Bench
+
+#endif
@@ -0,0 +1,947 @@
+// End-to-end frame benchmark on an offscreen context
+// Renders a generated scene through the whole pipeline: uniform buffer
+// updates, BaseGlObject draws with several shader programs, instance
+// uploads, streamed meshes and a chain of post processing passes run
+// through a RenderGraph. The context is created
+// with EGL on the surfaceless platform, so no display or GPU is needed
+// and it runs on Mesa's llvmpipe. Numbers are only comparable between
+// runs on the same machine and driver, --software forces llvmpipe.
+// With --gpu-culling the grids become meshes of a single object that is
+// culled and drawn by GpuCulling. Frames alternate between the draw count
+// path and the instance count path, and every frame the meshes the GPU
+// kept are compared with the CPU culling, a mismatch fails the run.
+// After the frames a noise tile is baked with both NoiseBaker backends
+// and reloaded from its disk cache, differing tiles fail the run too.
+//
+// Build from the repository root by compiling with -O2 -Isrc:
+//   bench/FrameBenchmark.cpp
+//   src/objects/AttributeLayout.cpp src/objects/BaseGlObject.cpp src/objects/MeshBuilder.cpp
+//   src/render/Culling.cpp src/render/GpuCulling.cpp src/render/NoiseBaker.cpp src/render/RenderGraph.cpp
+//   src/shaders/Shaders.cpp src/buffers/UniformBufferObjects.cpp
+//   src/util/ExRandom.cpp src/util/GLHelper.cpp src/util/GLResources.cpp src/util/ImageWriter.cpp
+//   src/util/MemoryArena.cpp src/util/MemoryStats.cpp src/util/Profiler.cpp
+// and link with -lEGL -lGL -pthread.
+//
+// Usage:
+//   FrameBenchmark [--objects n] [--programs n] [--passes n]
+//                  [--instanced n] [--instances n] [--stream n] [--min-size n] [--max-size n]
+//                  [--width n] [--height n] [--frames n] [--warmup n] [--seed n]
+//                  [--software] [--gpu-culling] [--json file] [--trace file] [--capture file]
+//                  [--baseline file] [--tolerance fraction]
+// Objects are grids of min-size to max-size quads per side. Every frame
+// --stream objects drop their buffers and upload them again, like chunks
+// streamed in and out. With a
+// baseline the exit code is the number of metrics that got slower than
+// the tolerance (default 0.10) allows.
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../src/buffers/UniformBufferObjects.h"
+#include "../src/objects/BaseGlObject.h"
+#include "../src/objects/MeshBuilder.h"
+#include "../src/render/Culling.h"
+#include "../src/render/GpuCulling.h"
+#include "../src/render/NoiseBaker.h"
+#include "../src/render/RenderGraph.h"
+#include "../src/shaders/Shaders.h"
+#include "../src/util/ExRandom.h"
+#include "../src/util/GLHelper.h"
+#include "../src/util/GLResources.h"
+#include "../src/util/ImageWriter.h"
+#include "../src/util/MemoryArena.h"
+#include "../src/util/MemoryStats.h"
+#include "../src/util/Profiler.h"
+#include "BenchHarness.h"
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	double millisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	struct Options {
+		unsigned int objects = 200;
+		unsigned int programs = 8;
+		unsigned int passes = 4;
+		unsigned int instanced = 8;
+		unsigned int instances = 32;
+		unsigned int stream = 8;
+		unsigned int minSize = 2;
+		unsigned int maxSize = 24;
+		unsigned int width = 640;
+		unsigned int height = 360;
+		unsigned int frames = 300;
+		unsigned int warmup = 30;
+		unsigned int seed = 1;
+		bool software = false;
+		bool gpuCulling = false;
+		std::string json;
+		std::string trace;
+		std::string capture;
+		std::string baseline;
+		double tolerance = 0.10;
+	};
+
+	bool parseOptions(int argc, char** argv, Options& O)
+	{
+		struct UnsignedOption {
+			const char* name;
+			unsigned int* value;
+		};
+		const UnsignedOption unsignedOptions[] = {
+			{"--objects", &O.objects},
+			{"--programs", &O.programs},
+			{"--passes", &O.passes},
+			{"--instanced", &O.instanced},
+			{"--instances", &O.instances},
+			{"--stream", &O.stream},
+			{"--min-size", &O.minSize},
+			{"--max-size", &O.maxSize},
+			{"--width", &O.width},
+			{"--height", &O.height},
+			{"--frames", &O.frames},
+			{"--warmup", &O.warmup},
+			{"--seed", &O.seed},
+		};
+		for(int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if(arg == "--software") {
+				O.software = true;
+				continue;
+			}
+			if(arg == "--gpu-culling") {
+				O.gpuCulling = true;
+				continue;
+			}
+			if(i + 1 >= argc) {
+				printf("Error: Unknown or incomplete option %s\n", arg.c_str());
+				return false;
+			}
+			const char* value = argv[++i];
+			bool found = false;
+			for(const UnsignedOption& U : unsignedOptions) {
+				if(arg != U.name) continue;
+				*U.value = (unsigned int) strtoul(value, nullptr, 10);
+				found = true;
+			}
+			if(found) continue;
+			if(arg == "--json") {
+				O.json = value;
+			} else if(arg == "--trace") {
+				O.trace = value;
+			} else if(arg == "--capture") {
+				O.capture = value;
+			} else if(arg == "--baseline") {
+				O.baseline = value;
+			} else if(arg == "--tolerance") {
+				O.tolerance = atof(value);
+			} else {
+				printf("Error: Unknown option %s\n", arg.c_str());
+				return false;
+			}
+		}
+		if((O.programs == 0) || (O.stream > O.objects) || (O.minSize == 0) || (O.maxSize < O.minSize) || (O.width == 0) || (O.height == 0) || (O.frames == 0)) {
+			printf("Error: Needs at least one program and frame, a size, min-size <= max-size and stream <= objects\n");
+			return false;
+		}
+		return true;
+	}
+
+	// Surfaceless context, everything is drawn into framebuffer objects
+	class OffscreenContext {
+	  private:
+		EGLDisplay display;
+		EGLContext context;
+
+	  public:
+		OffscreenContext() :
+			display(EGL_NO_DISPLAY),
+			context(EGL_NO_CONTEXT)
+		{}
+		~OffscreenContext()
+		{
+			if(display == EGL_NO_DISPLAY) return;
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			if(context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+			eglTerminate(display);
+		}
+		bool create(bool software)
+		{
+			// Read by Mesa when the display is initialized
+			if(software) setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+			PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+			if(getPlatformDisplay) display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+			if(display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+			EGLint major, minor;
+			if((display == EGL_NO_DISPLAY) || !eglInitialize(display, &major, &minor)) {
+				printf("Error: Can't initialize an EGL display\n");
+				display = EGL_NO_DISPLAY;
+				return false;
+			}
+			eglBindAPI(EGL_OPENGL_API);
+			// Surfaceless displays usually have no configs, which
+			// is fine since we never create a surface
+			const EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+			EGLConfig config = nullptr;
+			EGLint configs = 0;
+			eglChooseConfig(display, configAttributes, &config, 1, &configs);
+			const EGLint contextAttributes[] = {
+				EGL_CONTEXT_MAJOR_VERSION, 4,
+				EGL_CONTEXT_MINOR_VERSION, 5,
+				EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+				EGL_NONE};
+			context = eglCreateContext(display, configs ? config : nullptr, EGL_NO_CONTEXT, contextAttributes);
+			if(context == EGL_NO_CONTEXT) {
+				printf("Error: Can't create a GL 4.5 core context (EGL error 0x%x)\n", eglGetError());
+				return false;
+			}
+			if(!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+				printf("Error: Can't make the context current, surfaceless contexts might not be supported\n");
+				return false;
+			}
+			return true;
+		}
+	};
+
+	const char* sceneVertexSource = R"(#version 430
+layout(std140, binding = 0) uniform Transforms {
+	mat4 toWorldSpace;
+	mat4 perspective;
+};
+in vec3 position;
+in vec3 normal;
+out vec3 worldNormal;
+void main()
+{
+	worldNormal = normal;
+	gl_Position = perspective * toWorldSpace * vec4(position, 1.0);
+}
+)";
+
+	const char* instancedVertexSource = R"(#version 430
+layout(std140, binding = 0) uniform Transforms {
+	mat4 toWorldSpace;
+	mat4 perspective;
+};
+in vec3 position;
+in vec3 normal;
+// xyz is added to the position, w scales the object
+in vec4 offset;
+out vec3 worldNormal;
+void main()
+{
+	worldNormal = normal;
+	gl_Position = perspective * toWorldSpace * vec4(position * offset.w + offset.xyz, 1.0);
+}
+)";
+
+	// Every program gets its own tint, so no two sources are the same
+	std::string sceneFragmentSource(const glm::vec3& tint)
+	{
+		char buffer[512];
+		snprintf(buffer, sizeof(buffer), R"(#version 430
+in vec3 worldNormal;
+out vec4 color;
+const vec3 tint = vec3(%f, %f, %f);
+void main()
+{
+	float light = max(dot(normalize(worldNormal), normalize(vec3(0.3, 1.0, 0.5))), 0.0);
+	color = vec4(tint * (0.2 + 0.8 * light), 1.0);
+}
+)",
+				 tint.x, tint.y, tint.z);
+		return buffer;
+	}
+
+	// Fullscreen triangle strip for applyPostProcessing
+	const char* postVertexSource = R"(#version 430
+out vec2 uv;
+void main()
+{
+	uv = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+	// The passes are used in turn
+	const char* postFragmentSources[] = {
+		// Blur
+		R"(#version 430
+layout(binding = 0) uniform sampler2D source;
+in vec2 uv;
+out vec4 color;
+void main()
+{
+	color = 0.4 * texture(source, uv);
+	color += 0.15 * textureOffset(source, uv, ivec2(1, 0));
+	color += 0.15 * textureOffset(source, uv, ivec2(-1, 0));
+	color += 0.15 * textureOffset(source, uv, ivec2(0, 1));
+	color += 0.15 * textureOffset(source, uv, ivec2(0, -1));
+}
+)",
+		// Tone mapping
+		R"(#version 430
+layout(binding = 0) uniform sampler2D source;
+in vec2 uv;
+out vec4 color;
+void main()
+{
+	vec3 c = texture(source, uv).rgb;
+	color = vec4(pow(c / (1.0 + c), vec3(1.0 / 2.2)), 1.0);
+}
+)",
+		// Vignette
+		R"(#version 430
+layout(binding = 0) uniform sampler2D source;
+in vec2 uv;
+out vec4 color;
+void main()
+{
+	vec2 d = uv - 0.5;
+	color = texture(source, uv) * (1.0 - dot(d, d));
+}
+)",
+		// Chromatic aberration
+		R"(#version 430
+layout(binding = 0) uniform sampler2D source;
+in vec2 uv;
+out vec4 color;
+void main()
+{
+	vec2 d = (uv - 0.5) * 0.004;
+	color = vec4(texture(source, uv + d).r, texture(source, uv).g, texture(source, uv - d).b, 1.0);
+}
+)"};
+	const unsigned int POST_KINDS = sizeof(postFragmentSources) / sizeof(postFragmentSources[0]);
+
+	struct SceneVertex {
+		float position[3];
+		float normal[3];
+	};
+
+	struct SceneInstance {
+		float offset[4];
+	};
+
+	const AttributeLayout sceneLayout = ATTRIB_LOC(SceneVertex, position) + ATTRIB_LOC(SceneVertex, normal);
+	const AttributeLayout instanceLayout = AttributeLayout(ATTRIB_LOC(SceneInstance, offset));
+
+	struct RenderTarget {
+		unsigned int fbo = 0;
+		unsigned int texture = 0;
+		unsigned int depth = 0;
+	};
+
+	RenderTarget createTarget(unsigned int width, unsigned int height, bool depth)
+	{
+		RenderTarget T;
+		glGenTextures(1, &T.texture);
+		glBindTexture(GL_TEXTURE_2D, T.texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		GLHelper::setTextureParameters(GL_LINEAR, GL_CLAMP_TO_EDGE);
+		glGenFramebuffers(1, &T.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, T.fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, T.texture, 0);
+		if(depth) {
+			glGenRenderbuffers(1, &T.depth);
+			glBindRenderbuffer(GL_RENDERBUFFER, T.depth);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, T.depth);
+		}
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			printf("Error: Incomplete framebuffer for the benchmark\n");
+		}
+		MemoryStats::allocate(MemoryStats::Category::Texture, MemoryStats::textureBytes(width, height, 4, false) * (depth ? 2 : 1));
+		return T;
+	}
+
+	void deleteTarget(RenderTarget& T, unsigned int width, unsigned int height)
+	{
+		glDeleteFramebuffers(1, &T.fbo);
+		glDeleteTextures(1, &T.texture);
+		if(T.depth) glDeleteRenderbuffers(1, &T.depth);
+		MemoryStats::release(MemoryStats::Category::Texture, MemoryStats::textureBytes(width, height, 4, false) * (T.depth ? 2 : 1));
+	}
+
+	// A program and the files it is built from
+	struct Program {
+		SimpleShaderInfo info;
+		ShaderProgram program;
+		std::vector<std::unique_ptr<ShaderFile>> files;
+		Program() :
+			program(info)
+		{}
+	};
+
+	class Scene {
+	  private:
+		const Options& options;
+		// ShaderFile reads from disk, so the generated sources go here
+		std::filesystem::path shaderDirectory;
+		std::vector<std::unique_ptr<Program>> scenePrograms;
+		std::unique_ptr<Program> instancedProgram;
+		std::vector<std::unique_ptr<Program>> postPrograms;
+		// Mesh data of the whole scene, like a level load
+		MemoryArena meshArena;
+		std::vector<std::unique_ptr<BaseGlObject>> objects;
+		std::vector<std::unique_ptr<BaseGlObject>> instancedObjects;
+		// All grids as meshes of one object with --gpu-culling
+		std::unique_ptr<BaseGlObject> culledObject;
+		std::unique_ptr<GpuCulling> gpuCulling;
+		Culling::SphereSet meshSpheres;
+		std::vector<glm::vec4> meshSphereList;
+		std::vector<unsigned int> gpuVisible;
+		std::vector<unsigned int> cpuVisible;
+		std::unique_ptr<GlobalUBOs> ubos;
+		RenderTarget sceneTarget;
+		// One transient target per pass, the graph aliases them
+		std::unique_ptr<RenderGraph> postGraph;
+		RenderGraph::Resource postOutput;
+
+		std::unique_ptr<Program> createProgram(const std::string& name, const std::string& vertex, const std::string& fragment)
+		{
+			std::unique_ptr<Program> P(new Program());
+			const std::string sources[2] = {vertex, fragment};
+			const char* endings[2] = {".vert", ".frag"};
+			for(unsigned int i = 0; i < 2; i++) {
+				std::string fileName = (shaderDirectory / (name + endings[i])).string();
+				std::ofstream(fileName) << sources[i];
+				P->files.emplace_back(new ShaderFile(fileName));
+				P->program.appendShader(P->files.back().get());
+			}
+			P->program.reload();
+			return P;
+		}
+
+		// Appends to M and returns the bounding sphere
+		glm::vec4 buildGrid(MeshBuilder& M, ExRandom& Rand, unsigned int size)
+		{
+			const float spacing = 0.25f;
+			const float amplitude = (float) Rand.getDouble01() * 0.5f;
+			const float frequency = 0.5f + (float) Rand.getDouble01() * 2.0f;
+			const float x0 = ((float) Rand.getDouble01() - 0.5f) * 100.0f;
+			const float z0 = ((float) Rand.getDouble01() - 0.5f) * 100.0f;
+			const unsigned int base = M.sizeVertices();
+			// Builders shared by several grids grow as usual
+			if(base == 0) M.reserve((size + 1) * (size + 1), 6 * size * size);
+			for(unsigned int j = 0; j <= size; j++) {
+				for(unsigned int i = 0; i <= size; i++) {
+					float x = i * spacing;
+					float z = j * spacing;
+					SceneVertex v;
+					v.position[0] = x0 + x;
+					v.position[1] = amplitude * std::sin(x * frequency) * std::cos(z * frequency);
+					v.position[2] = z0 + z;
+					glm::vec3 n = glm::normalize(glm::vec3(-amplitude * frequency * std::cos(x * frequency) * std::cos(z * frequency), 1.0f,
+														   amplitude * frequency * std::sin(x * frequency) * std::sin(z * frequency)));
+					v.normal[0] = n.x;
+					v.normal[1] = n.y;
+					v.normal[2] = n.z;
+					M.addVertex(v);
+				}
+			}
+			for(unsigned int j = 0; j < size; j++) {
+				for(unsigned int i = 0; i < size; i++) {
+					unsigned int a = base + j * (size + 1) + i;
+					M.connectQuadrangle(a, a + 1, a + size + 2, a + size + 1);
+				}
+			}
+			const float half = size * spacing * 0.5f;
+			return glm::vec4(x0 + half, 0.0f, z0 + half, std::sqrt(2.0f * half * half + amplitude * amplitude));
+		}
+
+		// Request a tile and wait until it is ready, then read it back
+		static bool bakeNoiseTile(NoiseBaker& B, std::vector<float>& texels)
+		{
+			Clock::time_point start = Clock::now();
+			B.requestTile(1, -2);
+			unsigned int texture = 0;
+			while(texture == 0) {
+				if(millisecondsSince(start) > 10000) {
+					printf("Error: Baking a noise tile timed out\n");
+					return false;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				B.update();
+				texture = B.getTile(1, -2);
+			}
+			texels.resize(B.texelsPerTile());
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, texels.data());
+			return true;
+		}
+
+		// Compare the meshes the GPU kept with the CPU culling
+		// Spheres within a small distance of a plane may go either way.
+		void checkCulling(const Culling::Frustum& F)
+		{
+			gpuVisible.clear();
+			cpuVisible.clear();
+			gpuCulling->readVisible(gpuVisible);
+			Culling::cullSpheres(F, meshSpheres, cpuVisible);
+			std::sort(gpuVisible.begin(), gpuVisible.end());
+			std::vector<unsigned int> differing;
+			std::set_symmetric_difference(gpuVisible.begin(), gpuVisible.end(), cpuVisible.begin(), cpuVisible.end(), std::back_inserter(differing));
+			bool mismatch = false;
+			for(unsigned int m : differing) {
+				const glm::vec4& S = meshSphereList[m];
+				float margin = 1e30f;
+				for(const glm::vec4& p : F.planes)
+					margin = std::min(margin, p.x * S.x + p.y * S.y + p.z * S.z + p.w + S.w);
+				if(std::fabs(margin) > 1e-3f * (1.0f + S.w)) mismatch = true;
+			}
+			cullingCheck.frames++;
+			if(gpuCulling->usesDrawCount()) cullingCheck.drawCountFrames++;
+			if(mismatch) cullingCheck.mismatches++;
+			cullingCheck.visible += gpuVisible.size();
+		}
+
+	  public:
+		uint64_t vertices;
+		uint64_t triangles;
+		struct NoiseCheck {
+			// The compute backend was used instead of a second CPU bake
+			bool compute = false;
+			// Largest difference between the backends, relative above 1
+			float maxError = 0.0f;
+			// The third bake was read from the disk cache unchanged
+			bool cached = false;
+			bool passed = false;
+		};
+		struct CullingCheck {
+			uint64_t frames = 0;
+			uint64_t drawCountFrames = 0;
+			// Frames where the GPU and the CPU disagreed
+			uint64_t mismatches = 0;
+			uint64_t visible = 0;
+			unsigned int meshes = 0;
+		} cullingCheck;
+
+		Scene(const Options& options_) :
+			options(options_),
+			postOutput(0),
+			vertices(0),
+			triangles(0)
+		{}
+
+		~Scene()
+		{
+			objects.clear();
+			instancedObjects.clear();
+			culledObject.reset();
+			gpuCulling.reset();
+			scenePrograms.clear();
+			instancedProgram.reset();
+			postPrograms.clear();
+			ubos.reset();
+			postGraph.reset();
+			// Everything deleted above may still be waiting for its frame
+			GLResources::clear();
+			if(sceneTarget.fbo) deleteTarget(sceneTarget, options.width, options.height);
+			if(!shaderDirectory.empty()) {
+				std::error_code error;
+				std::filesystem::remove_all(shaderDirectory, error);
+			}
+		}
+
+		bool create()
+		{
+			shaderDirectory = std::filesystem::temp_directory_path() / ("jg_frame_benchmark_" + std::to_string(getpid()));
+			std::filesystem::create_directories(shaderDirectory);
+			ExRandom Rand(options.seed);
+			// Shaders
+			for(unsigned int p = 0; p < options.programs; p++) {
+				glm::vec3 tint((float) Rand.getDouble01(), (float) Rand.getDouble01(), (float) Rand.getDouble01());
+				scenePrograms.push_back(createProgram("scene" + std::to_string(p), sceneVertexSource, sceneFragmentSource(tint)));
+			}
+			instancedProgram = createProgram("instanced", instancedVertexSource, sceneFragmentSource(glm::vec3(0.8f)));
+			for(unsigned int k = 0; k < std::min(options.passes, POST_KINDS); k++) {
+				postPrograms.push_back(createProgram("post" + std::to_string(k), postVertexSource, postFragmentSources[k]));
+			}
+			for(const std::unique_ptr<Program>& P : scenePrograms) {
+				if(!P->info.useable) return false;
+			}
+			if(!instancedProgram->info.useable) return false;
+			for(const std::unique_ptr<Program>& P : postPrograms) {
+				if(!P->info.useable) return false;
+			}
+			if(options.gpuCulling) {
+				gpuCulling.reset(new GpuCulling());
+				if(!gpuCulling->isUseable()) return false;
+				MeshBuilder M(sceneLayout, meshArena.resource(), meshArena.nodeResource());
+				M.setWelding(false);
+				for(unsigned int o = 0; o < options.objects; o++) {
+					unsigned int firstIndex = M.sizeIndeces();
+					glm::vec4 sphere = buildGrid(M, Rand, options.minSize + Rand.getUInt32() % (options.maxSize - options.minSize + 1));
+					gpuCulling->addMesh(firstIndex, M.sizeIndeces() - firstIndex, sphere);
+					meshSpheres.add(sphere);
+					meshSphereList.push_back(sphere);
+				}
+				culledObject.reset(new BaseGlObject(sceneLayout, AttributeLayout(), meshArena.resource(), meshArena.nodeResource()));
+				culledObject->takeMesh(std::move(M));
+				vertices += culledObject->sizeVertices();
+				triangles += culledObject->sizeIndeces() / 3;
+				culledObject->setShader(&scenePrograms[0]->info);
+				culledObject->copyDataToGraphicsCard();
+				cullingCheck.meshes = options.objects;
+			}
+			// Objects, consecutive objects share a program
+			for(unsigned int o = options.gpuCulling ? options.objects : 0; o < options.objects + options.instanced; o++) {
+				bool instanced = o >= options.objects;
+				MeshBuilder M(sceneLayout, meshArena.resource(), meshArena.nodeResource());
+				M.setWelding(false);
+				buildGrid(M, Rand, options.minSize + Rand.getUInt32() % (options.maxSize - options.minSize + 1));
+				std::unique_ptr<BaseGlObject> B(new BaseGlObject(sceneLayout, instanced ? instanceLayout : AttributeLayout(), meshArena.resource(), meshArena.nodeResource()));
+				B->takeMesh(std::move(M));
+				vertices += B->sizeVertices();
+				if(instanced) {
+					for(unsigned int i = 0; i < options.instances; i++) {
+						B->addInstance(SceneInstance{{0.0f, 0.0f, 0.0f, 1.0f}});
+					}
+					triangles += (uint64_t) B->sizeIndeces() / 3 * options.instances;
+					B->setShader(&instancedProgram->info);
+					instancedObjects.push_back(std::move(B));
+				} else {
+					triangles += B->sizeIndeces() / 3;
+					B->setShader(&scenePrograms[(uint64_t) o * options.programs / std::max(1u, options.objects)]->info);
+					objects.push_back(std::move(B));
+				}
+			}
+			for(std::unique_ptr<BaseGlObject>& B : objects) {
+				B->copyDataToGraphicsCard();
+			}
+			for(std::unique_ptr<BaseGlObject>& B : instancedObjects) {
+				B->copyDataToGraphicsCard();
+			}
+			ubos.reset(new GlobalUBOs());
+			// Render targets
+			sceneTarget = createTarget(options.width, options.height, true);
+			postGraph.reset(new RenderGraph(options.width, options.height));
+			postOutput = postGraph->importTexture("scene", sceneTarget.texture, options.width, options.height);
+			for(unsigned int p = 0; p < options.passes; p++) {
+				RenderGraph::Resource target = postGraph->createTexture("post" + std::to_string(p));
+				postGraph->addPostProcessingPass("post" + std::to_string(p), &postPrograms[p % postPrograms.size()]->info, {postOutput}, target);
+				postOutput = target;
+			}
+			if(options.passes) postGraph->markOutput(postOutput);
+			return postGraph->compile();
+		}
+
+		void render(unsigned int frame)
+		{
+			PROFILE_CPU_ZONE("FrameBenchmark::render");
+			// Orbiting camera
+			float angle = frame * 0.01f;
+			UBOTransforms& T = ubos->transforms().get();
+			T.toWorldSpace = glm::lookAt(glm::vec3(80.0f * std::cos(angle), 40.0f, 80.0f * std::sin(angle)), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+			if(gpuCulling) {
+				// Inside the scene, so a good part of it gets culled
+				glm::vec3 eye(20.0f * std::cos(angle), 10.0f, 20.0f * std::sin(angle));
+				T.toWorldSpace = glm::lookAt(eye, glm::vec3(-eye.x, 0.0f, -eye.z), glm::vec3(0.0f, 1.0f, 0.0f));
+			}
+			T.perspective = glm::perspective(1.0f, (float) options.width / options.height, 0.5f, 500.0f);
+			ubos->update();
+			// Streamed objects, a different set every frame
+			for(unsigned int s = 0; s < (objects.empty() ? 0 : options.stream); s++) {
+				BaseGlObject& B = *objects[((uint64_t) frame * options.stream + s) % objects.size()];
+				B.clearDataFromGraphicsCard();
+				B.copyDataToGraphicsCard();
+			}
+			// Every instance moves every frame
+			for(size_t o = 0; o < instancedObjects.size(); o++) {
+				BaseGlObject& B = *instancedObjects[o];
+				for(unsigned int i = 0; i < B.sizeInstances(); i++) {
+					float a = (float) i / B.sizeInstances() * 6.2831853f + o;
+					float r = 20.0f + 2.0f * o;
+					B.updateInstance(i, SceneInstance{{r * std::cos(a), 5.0f + std::sin(a * 3.0f + frame * 0.05f), r * std::sin(a), 0.5f}});
+				}
+			}
+			// Scene
+			glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget.fbo);
+			glViewport(0, 0, options.width, options.height);
+			glEnable(GL_DEPTH_TEST);
+			glClearColor(0.1f, 0.1f, 0.15f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			for(std::unique_ptr<BaseGlObject>& B : objects) {
+				B->drawObject();
+			}
+			if(gpuCulling) {
+				// Every other frame takes the instance count path
+				gpuCulling->setDrawCount(frame % 2 == 0);
+				Culling::Frustum F = Culling::extractFrustum(T);
+				gpuCulling->cull(F);
+				gpuCulling->draw(*culledObject);
+				checkCulling(F);
+			}
+			for(std::unique_ptr<BaseGlObject>& B : instancedObjects) {
+				B->drawObjectInstanced();
+			}
+			// Post processing chain
+			glDisable(GL_DEPTH_TEST);
+			postGraph->execute();
+		}
+
+		inline const RenderGraph::Statistics& postStatistics() const { return postGraph->getStatistics(); };
+		inline MemoryArena::Statistics meshMemory() const { return meshArena.statistics(); };
+
+		bool capture(const std::string& fileName)
+		{
+			std::vector<unsigned char> pixels((size_t) options.width * options.height * 4);
+			std::vector<unsigned char> flipped(pixels.size());
+			glBindTexture(GL_TEXTURE_2D, postGraph->getTexture(postOutput));
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+			GLHelper::copyImageFlippedY(pixels.data(), flipped.data(), options.width, options.height);
+			return ImageWriter::writePNG(fileName.c_str(), flipped.data(), options.width, options.height);
+		}
+
+		// Bakes a noise tile with the CPU and the compute backend and
+		// reloads it from the disk cache. The compute tile has to match
+		// the CPU tile within the precision of R16F, the reloaded tile
+		// has to match the compute tile exactly.
+		NoiseCheck checkNoise()
+		{
+			NoiseCheck C;
+			const UBOPerlinNoise& tables = ubos->perlinNoise().read();
+			NoiseParameters P;
+			P.tileSize = 64;
+			const std::string cache = (shaderDirectory / "noise").string();
+			std::filesystem::create_directories(cache);
+			std::vector<float> cpu;
+			std::vector<float> baked;
+			std::vector<float> loaded;
+			{
+				NoiseBaker B(tables, P);
+				if(!bakeNoiseTile(B, cpu)) return C;
+			}
+			{
+				// Falls back to the CPU without compute shaders
+				NoiseBaker B(tables, P, cache);
+				C.compute = B.setBackend(NoiseBaker::Backend::Compute);
+				if(!bakeNoiseTile(B, baked)) return C;
+				// Hand the tile to a worker for saving, it is written
+				// before the destructor returns
+				glFinish();
+				B.update();
+			}
+			{
+				NoiseBaker B(tables, P, cache);
+				if(!bakeNoiseTile(B, loaded)) return C;
+				C.cached = (B.loadedTileCount() == 1) && (loaded == baked);
+			}
+			for(size_t i = 0; i < cpu.size(); i++) {
+				C.maxError = std::max(C.maxError, std::fabs(baked[i] - cpu[i]) / std::max(1.0f, std::fabs(cpu[i])));
+			}
+			// R16F keeps 11 significant bits, the backends may round differently
+			C.passed = C.cached && (C.maxError <= 1e-3f);
+			return C;
+		}
+	};
+
+	struct Summary {
+		double mean = 0;
+		double median = 0;
+		double p95 = 0;
+		double min = 0;
+		double max = 0;
+	};
+
+	Summary summarize(std::vector<double> samples)
+	{
+		Summary S;
+		if(samples.empty()) return S;
+		std::sort(samples.begin(), samples.end());
+		for(double s : samples)
+			S.mean += s;
+		S.mean /= samples.size();
+		S.median = samples[samples.size() / 2];
+		S.p95 = samples[std::min(samples.size() - 1, samples.size() * 95 / 100)];
+		S.min = samples.front();
+		S.max = samples.back();
+		return S;
+	}
+
+	void writeSummaryJSON(FILE* f, const char* name, const Summary& S)
+	{
+		fprintf(f, "\"%s\":{\"mean\":%.4f,\"median\":%.4f,\"p95\":%.4f,\"min\":%.4f,\"max\":%.4f}", name, S.mean, S.median, S.p95, S.min, S.max);
+	}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	Clock::time_point start = Clock::now();
+	Options options;
+	if(!parseOptions(argc, argv, options)) return 1;
+
+	OffscreenContext context;
+	if(!context.create(options.software)) return 1;
+	const double contextMs = millisecondsSince(start);
+	std::string renderer = (const char*) glGetString(GL_RENDERER);
+	std::string version = (const char*) glGetString(GL_VERSION);
+
+	// Counters are only collected while the profiler is enabled
+	Profiler::setEnabled(true);
+	if(options.trace == "") Profiler::setMaxEvents(0);
+	std::vector<double> cpuMs;
+	std::vector<double> totalMs;
+	Profiler::FrameCounters counters;
+	GLResources::Statistics resources;
+	RenderGraph::Statistics post;
+	MemoryArena::Statistics meshes;
+	uint64_t startupBytes = 0;
+	Scene::CullingCheck culling;
+	Scene::NoiseCheck noise;
+	double sceneMs = 0;
+	double firstFrameMs = 0;
+	double loopSeconds = 0;
+	{
+		Scene scene(options);
+		// Startup is recorded as one frame so its uploads are counted
+		Clock::time_point sceneStart = Clock::now();
+		Profiler::beginFrame();
+		bool created = scene.create();
+		Profiler::endFrame();
+		if(!created) {
+			printf("Error: Can't build the benchmark scene\n");
+			return 1;
+		}
+		startupBytes = Profiler::lastFrame().bytesUploaded;
+		glFinish();
+		sceneMs = millisecondsSince(sceneStart);
+
+		Clock::time_point loopStart;
+		for(unsigned int f = 0; f < options.warmup + options.frames; f++) {
+			if(f == options.warmup) loopStart = Clock::now();
+			Clock::time_point t0 = Clock::now();
+			Profiler::beginFrame();
+			scene.render(f);
+			GLResources::endFrame();
+			Profiler::endFrame();
+			double cpu = millisecondsSince(t0);
+			// Keep the driver from queueing frames, so the
+			// total includes rendering the frame
+			glFinish();
+			double total = millisecondsSince(t0);
+			if(f == 0) firstFrameMs = total;
+			if(f + 1 == options.warmup) GLResources::resetStatistics();
+			if(f < options.warmup) continue;
+			cpuMs.push_back(cpu);
+			totalMs.push_back(total);
+			const Profiler::FrameCounters& C = Profiler::lastFrame();
+			counters.draws += C.draws;
+			counters.triangles += C.triangles;
+			counters.binds += C.binds;
+			counters.bytesUploaded += C.bytesUploaded;
+		}
+		loopSeconds = std::chrono::duration<double>(Clock::now() - loopStart).count();
+		resources = GLResources::statistics();
+		post = scene.postStatistics();
+		meshes = scene.meshMemory();
+		culling = scene.cullingCheck;
+		if(options.capture != "") scene.capture(options.capture);
+		noise = scene.checkNoise();
+		if(options.trace != "") Profiler::writeChromeTrace(options.trace);
+	}
+	const double startupMs = contextMs + sceneMs + firstFrameMs;
+	const Summary cpu = summarize(cpuMs);
+	const Summary total = summarize(totalMs);
+	const double frames = options.frames;
+
+	printf("Renderer      %s, %s\n", renderer.c_str(), version.c_str());
+	printf("Scene         %u objects, %u programs, %u post passes, %u x %u instances, %.2f M triangles\n",
+		   options.objects, options.programs, options.passes, options.instanced, options.instances, counters.triangles / frames * 1e-6);
+	printf("Startup       %.2f ms (context %.2f ms, scene %.2f ms, first frame %.2f ms)\n", startupMs, contextMs, sceneMs, firstFrameMs);
+	printf("CPU frame     mean %.3f ms, median %.3f ms, p95 %.3f ms, max %.3f ms\n", cpu.mean, cpu.median, cpu.p95, cpu.max);
+	printf("Total frame   mean %.3f ms, median %.3f ms, p95 %.3f ms, max %.3f ms\n", total.mean, total.median, total.p95, total.max);
+	printf("Draws         %.0f per frame, %.0f per second\n", counters.draws / frames, counters.draws / loopSeconds);
+	printf("Uploads       %.1f KiB per frame, %.2f MiB at startup\n", counters.bytesUploaded / frames / 1024.0, startupBytes / 1048576.0);
+	printf("Pools         %.1f%% of buffers and %.1f%% of vertex arrays reused, %.2f MiB idle\n", resources.bufferReuseRate() * 100,
+		   resources.vertexArrayReuseRate() * 100, resources.pooledBufferBytes / 1048576.0);
+	printf("Mesh memory   %llu allocations, %llu from the heap, %.2f MiB\n", (unsigned long long) (meshes.allocations + meshes.nodeAllocations),
+		   (unsigned long long) meshes.heapAllocations, meshes.peakHeapBytes / 1048576.0);
+	printf("Post targets  %u textures for %u passes, %.2f MiB instead of %.2f MiB\n", post.physicalTextures, post.transientTextures,
+		   post.textureBytes / 1048576.0, post.unaliasedBytes / 1048576.0);
+	printf("Noise tiles   %s backend within %.2g of the CPU, %s\n", noise.compute ? "compute" : "CPU", noise.maxError,
+		   noise.cached ? "reloaded from the disk cache" : "not reloaded from the disk cache");
+	if(options.gpuCulling) {
+		printf("GPU culling   %.1f of %u meshes visible, %llu of %llu frames with a draw count, %llu frames differ from the CPU\n",
+			   (double) culling.visible / std::max<uint64_t>(1, culling.frames), culling.meshes, (unsigned long long) culling.drawCountFrames,
+			   (unsigned long long) culling.frames, (unsigned long long) culling.mismatches);
+	}
+
+	if(options.json != "") {
+		FILE* f = fopen(options.json.c_str(), "w");
+		if(f == nullptr) {
+			printf("Error: Can't write %s\n", options.json.c_str());
+		} else {
+			// The benchmarks array can be read as a baseline by Bench::readJSON
+			fprintf(f, "{\"benchmarks\":[\n");
+			fprintf(f, "{\"name\":\"Frame/cpu\",\"nsPerOp\":%.1f},\n", cpu.median * 1e6);
+			fprintf(f, "{\"name\":\"Frame/total\",\"nsPerOp\":%.1f},\n", total.median * 1e6);
+			fprintf(f, "{\"name\":\"Startup\",\"nsPerOp\":%.1f}\n],\n", startupMs * 1e6);
+			fprintf(f, "\"renderer\":\"%s\",\"version\":\"%s\",\n", renderer.c_str(), version.c_str());
+			fprintf(f, "\"scene\":{\"objects\":%u,\"programs\":%u,\"passes\":%u,\"instanced\":%u,\"instances\":%u,\"stream\":%u,\"minSize\":%u,\"maxSize\":%u,"
+					   "\"width\":%u,\"height\":%u,\"seed\":%u},\n",
+					options.objects, options.programs, options.passes, options.instanced, options.instances, options.stream, options.minSize, options.maxSize,
+					options.width, options.height, options.seed);
+			fprintf(f, "\"frames\":%u,\"warmup\":%u,\n", options.frames, options.warmup);
+			fprintf(f, "\"startupMs\":{\"total\":%.4f,\"context\":%.4f,\"scene\":%.4f,\"firstFrame\":%.4f},\n", startupMs, contextMs, sceneMs, firstFrameMs);
+			writeSummaryJSON(f, "cpuFrameMs", cpu);
+			fprintf(f, ",\n");
+			writeSummaryJSON(f, "totalFrameMs", total);
+			fprintf(f, ",\n\"drawsPerFrame\":%.2f,\"drawsPerSecond\":%.2f,\"trianglesPerFrame\":%.0f,\"bindsPerFrame\":%.2f,\n",
+					counters.draws / frames, counters.draws / loopSeconds, counters.triangles / frames, counters.binds / frames);
+			fprintf(f, "\"bytesUploaded\":%llu,\"bytesUploadedPerFrame\":%.2f,\"startupBytesUploaded\":%llu,\n",
+					(unsigned long long) counters.bytesUploaded, counters.bytesUploaded / frames, (unsigned long long) startupBytes);
+			fprintf(f, "\"bufferReuseRate\":%.4f,\"vertexArrayReuseRate\":%.4f,\"pooledBufferBytes\":%lld,\"deferredDeletions\":%llu,\n",
+					resources.bufferReuseRate(), resources.vertexArrayReuseRate(), (long long) resources.pooledBufferBytes,
+					(unsigned long long) resources.deferredDeletions);
+			fprintf(f, "\"postTextures\":%u,\"postTextureBytes\":%lld,\"postUnaliasedBytes\":%lld,\n", post.physicalTextures,
+					(long long) post.textureBytes, (long long) post.unaliasedBytes);
+			fprintf(f, "\"meshAllocations\":%llu,\"meshHeapAllocations\":%llu,\"meshHeapBytes\":%lld}\n",
+					(unsigned long long) (meshes.allocations + meshes.nodeAllocations), (unsigned long long) meshes.heapAllocations,
+					(long long) meshes.peakHeapBytes);
+			fclose(f);
+		}
+	}
+
+	if(!noise.passed) {
+		printf("Error: The noise backends or the noise cache gave different tiles\n");
+		return 1;
+	}
+	if(culling.mismatches > 0) {
+		printf("Error: GPU culling kept different meshes than the CPU culling\n");
+		return 1;
+	}
+	if(options.baseline != "") {
+		std::vector<Bench::Result> current(3);
+		current[0].name = "Frame/cpu";
+		current[0].nsPerOp = cpu.median * 1e6;
+		current[1].name = "Frame/total";
+		current[1].nsPerOp = total.median * 1e6;
+		current[2].name = "Startup";
+		current[2].nsPerOp = startupMs * 1e6;
+		return Bench::compare(current, Bench::readJSON(options.baseline), options.tolerance);
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+// No-op replacements for every OpenGL function used by the sources
+// the CPU benchmarks link against, so they run without a context.
+// Buffers and other objects just get increasing names.
+// If a benchmarked file starts calling a new GL function it has
+// to be added here as well.
+
+#include <GLInclude.h>
+
+namespace {
+	GLuint nextName = 1;
+
+	void genNames(GLsizei n, GLuint* names)
+	{
+		for(GLsizei i = 0; i < n; i++)
+			names[i] = nextName++;
+	}
+} // namespace
+
+// Buffers
+void APIENTRY glGenBuffers(GLsizei n, GLuint* buffers) { genNames(n, buffers); }
+void APIENTRY glDeleteBuffers(GLsizei, const GLuint*) {}
+void APIENTRY glBindBuffer(GLenum, GLuint) {}
+void APIENTRY glBindBufferBase(GLenum, GLuint, GLuint) {}
+void APIENTRY glBufferData(GLenum, GLsizeiptr, const void*, GLenum) {}
+void APIENTRY glBufferSubData(GLenum, GLintptr, GLsizeiptr, const void*) {}
+void APIENTRY glGetBufferSubData(GLenum, GLintptr, GLsizeiptr, void*) {}
+
+// Vertex arrays
+void APIENTRY glGenVertexArrays(GLsizei n, GLuint* arrays) { genNames(n, arrays); }
+void APIENTRY glDeleteVertexArrays(GLsizei, const GLuint*) {}
+void APIENTRY glBindVertexArray(GLuint) {}
+void APIENTRY glEnableVertexAttribArray(GLuint) {}
+void APIENTRY glDisableVertexAttribArray(GLuint) {}
+void APIENTRY glVertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) {}
+void APIENTRY glVertexAttribDivisor(GLuint, GLuint) {}
+void APIENTRY glVertexAttribFormat(GLuint, GLint, GLenum, GLboolean, GLuint) {}
+void APIENTRY glVertexAttribBinding(GLuint, GLuint) {}
+void APIENTRY glBindVertexBuffer(GLuint, GLuint, GLintptr, GLsizei) {}
+void APIENTRY glVertexBindingDivisor(GLuint, GLuint) {}
+GLint APIENTRY glGetAttribLocation(GLuint, const GLchar*) { return 0; }
+
+// Drawing
+void APIENTRY glUseProgram(GLuint) {}
+void APIENTRY glDrawElements(GLenum, GLsizei, GLenum, const void*) {}
+void APIENTRY glDrawElementsInstanced(GLenum, GLsizei, GLenum, const void*, GLsizei) {}
+void APIENTRY glDrawArrays(GLenum, GLint, GLsizei) {}
+void APIENTRY glMultiDrawElements(GLenum, const GLsizei*, GLenum, const void* const*, GLsizei) {}
+void APIENTRY glMultiDrawElementsIndirect(GLenum, GLenum, const void*, GLsizei, GLsizei) {}
+void APIENTRY glMultiDrawElementsIndirectCount(GLenum, GLenum, const void*, GLintptr, GLsizei, GLsizei) {}
+void APIENTRY glMultiDrawElementsIndirectCountARB(GLenum, GLenum, const void*, GLintptr, GLsizei, GLsizei) {}
+void APIENTRY glDispatchCompute(GLuint, GLuint, GLuint) {}
+
+// Shaders, they always compile and link
+GLuint APIENTRY glCreateShader(GLenum) { return nextName++; }
+void APIENTRY glShaderSource(GLuint, GLsizei, const GLchar* const*, const GLint*) {}
+void APIENTRY glCompileShader(GLuint) {}
+void APIENTRY glGetShaderiv(GLuint, GLenum pname, GLint* params) { *params = (pname == GL_COMPILE_STATUS) ? GL_TRUE : 0; }
+void APIENTRY glGetShaderInfoLog(GLuint, GLsizei, GLsizei* length, GLchar* infoLog)
+{
+	if(length) *length = 0;
+	if(infoLog) *infoLog = 0;
+}
+GLuint APIENTRY glCreateProgram() { return nextName++; }
+void APIENTRY glAttachShader(GLuint, GLuint) {}
+void APIENTRY glLinkProgram(GLuint) {}
+void APIENTRY glGetProgramiv(GLuint, GLenum pname, GLint* params) { *params = (pname == GL_LINK_STATUS) ? GL_TRUE : 0; }
+void APIENTRY glProgramUniform1iv(GLuint, GLint, GLsizei, const GLint*) {}
+void APIENTRY glProgramUniform1fv(GLuint, GLint, GLsizei, const GLfloat*) {}
+void APIENTRY glProgramUniform2fv(GLuint, GLint, GLsizei, const GLfloat*) {}
+void APIENTRY glProgramUniform3fv(GLuint, GLint, GLsizei, const GLfloat*) {}
+void APIENTRY glProgramUniform4fv(GLuint, GLint, GLsizei, const GLfloat*) {}
+void APIENTRY glProgramUniformMatrix4fv(GLuint, GLint, GLsizei, GLboolean, const GLfloat*) {}
+
+// State
+void APIENTRY glEnable(GLenum) {}
+void APIENTRY glDisable(GLenum) {}
+void APIENTRY glDepthMask(GLboolean) {}
+void APIENTRY glBlendFunc(GLenum, GLenum) {}
+void APIENTRY glViewport(GLint, GLint, GLsizei, GLsizei) {}
+void APIENTRY glClear(GLbitfield) {}
+
+// Textures
+void APIENTRY glTexParameteri(GLenum, GLenum, GLint) {}
+
+// Deletion, fences and limits used by GLResources
+void APIENTRY glDeleteTextures(GLsizei, const GLuint*) {}
+void APIENTRY glDeleteFramebuffers(GLsizei, const GLuint*) {}
+void APIENTRY glDeleteRenderbuffers(GLsizei, const GLuint*) {}
+void APIENTRY glDeleteShader(GLuint) {}
+void APIENTRY glDeleteProgram(GLuint) {}
+GLsync APIENTRY glFenceSync(GLenum, GLbitfield) { return (GLsync) 1; }
+GLenum APIENTRY glClientWaitSync(GLsync, GLbitfield, GLuint64) { return GL_ALREADY_SIGNALED; }
+void APIENTRY glDeleteSync(GLsync) {}
+void APIENTRY glFinish() {}
+void APIENTRY glGetIntegerv(GLenum, GLint* data) { *data = 16; }
+const GLubyte* APIENTRY glGetStringi(GLenum, GLuint) { return nullptr; }
+
+// Queries used by the profiler
+void APIENTRY glGenQueries(GLsizei n, GLuint* ids) { genNames(n, ids); }
+void APIENTRY glQueryCounter(GLuint, GLenum) {}
+void APIENTRY glGetQueryObjectiv(GLuint, GLenum, GLint* params) { *params = 0; }
+void APIENTRY glGetQueryObjectui64v(GLuint, GLenum, GLuint64* params) { *params = 0; }
+void APIENTRY glGetInteger64v(GLenum, GLint64* data) { *data = 0; }
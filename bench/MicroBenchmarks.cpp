@@ -0,0 +1,494 @@
+// CPU microbenchmarks for the hot paths that don't need a GPU
+// All GL calls are resolved by GLStubs.cpp.
+//
+// Build from the repository root by compiling with -O2 -Isrc:
+//   bench/MicroBenchmarks.cpp bench/GLStubs.cpp
+//   src/objects/AttributeLayout.cpp src/objects/BaseGlObject.cpp src/objects/MeshBuilder.cpp
+//   src/util/ExRandom.cpp src/util/GLHelper.cpp
+//   src/util/GLResources.cpp src/util/MemoryArena.cpp src/util/MemoryStats.cpp src/util/Profiler.cpp
+//   src/buffers/UniformBufferObjects.cpp
+//   src/render/Culling.cpp src/render/Meshlets.cpp src/render/RenderCommands.cpp
+//   src/shaders/Shaders.cpp
+//
+// Usage:
+//   MicroBenchmarks [--filter text] [--min-time seconds] [--json file]
+//                   [--baseline file] [--tolerance fraction]
+// With a baseline the exit code is the number of benchmarks that got
+// slower than the tolerance (default 0.10) allows.
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../src/buffers/UniformBufferObjects.h"
+#include "../src/objects/BaseGlObject.h"
+#include "../src/render/Culling.h"
+#include "../src/render/Meshlets.h"
+#include "../src/render/RenderCommands.h"
+#include "../src/shaders/Shaders.h"
+#include "../src/util/ExRandom.h"
+#include "../src/util/GLHelper.h"
+#include "../src/util/GLResources.h"
+#include "../src/util/MemoryArena.h"
+#include "BenchHarness.h"
+
+namespace {
+	struct BenchVertex {
+		float position[3];
+		float normal[3];
+	};
+
+	const AttributeLayout benchLayout = ATTRIB_LOC(BenchVertex, position) + ATTRIB_LOC(BenchVertex, normal);
+
+	// Larger than the 64 KiB a 16 bit payload size could hold
+	struct BenchLargeUBO {
+		uint32_t values[20000];
+	};
+
+	// Callback that logs which command ran
+	struct ReplayEntry {
+		std::vector<int>* log;
+		int id;
+	};
+
+	void logReplay(void* userData)
+	{
+		ReplayEntry* E = (ReplayEntry*) userData;
+		E->log->push_back(E->id);
+	}
+
+	// Vertices on a coarse grid so roughly half of them are duplicates
+	std::vector<BenchVertex> makeVertices(size_t count)
+	{
+		ExRandom Rand(7);
+		std::vector<BenchVertex> V(count);
+		for(BenchVertex& v : V) {
+			for(float& p : v.position)
+				p = (float) (Rand.getUInt32() % 48) * 0.25f;
+			v.normal[0] = 0;
+			v.normal[1] = 1;
+			v.normal[2] = 0;
+		}
+		return V;
+	}
+
+	// Grid of size x size quads sharing their corners
+	uint64_t fillGrid(BaseGlObject& O, unsigned int size, bool quads, bool track)
+	{
+		if(!track) O.disableVertexTracking();
+		BenchVertex v[4];
+		for(BenchVertex& c : v) {
+			c.normal[0] = 0;
+			c.normal[1] = 1;
+			c.normal[2] = 0;
+		}
+		for(unsigned int x = 0; x < size; x++) {
+			for(unsigned int z = 0; z < size; z++) {
+				for(unsigned int c = 0; c < 4; c++) {
+					v[c].position[0] = (float) (x + ((c == 1) || (c == 2)));
+					v[c].position[1] = 0;
+					v[c].position[2] = (float) (z + (c >= 2));
+				}
+				if(quads) {
+					O.addQuadrangle(v[0], v[1], v[2], v[3]);
+				} else {
+					O.addTriangle(v[0], v[1], v[2]);
+					O.addTriangle(v[0], v[2], v[3]);
+				}
+			}
+		}
+		Bench::doNotOptimize(O.sizeVertices());
+		return size * size;
+	}
+
+	// With an arena the object is built in it and the arena is reset afterwards
+	uint64_t buildGrid(unsigned int size, bool quads, bool track, MemoryArena* arena = nullptr)
+	{
+		if(!arena) {
+			BaseGlObject O(benchLayout);
+			return fillGrid(O, size, quads, track);
+		}
+		uint64_t quadCount = 0;
+		{
+			BaseGlObject O(benchLayout, AttributeLayout(), arena->resource(), arena->nodeResource());
+			quadCount = fillGrid(O, size, quads, track);
+		}
+		arena->reset();
+		return quadCount;
+	}
+
+	// UV sphere whose quads are connected in random order, so meshlets
+	// pick up triangles far apart in the index buffer
+	void fillShuffledSphere(BaseGlObject& O, unsigned int rings, unsigned int segments)
+	{
+		O.disableVertexTracking();
+		for(unsigned int r = 0; r <= rings; r++) {
+			float theta = (float) r / rings * 3.14159265f;
+			for(unsigned int s = 0; s <= segments; s++) {
+				float phi = (float) s / segments * 6.28318531f;
+				glm::vec3 n(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+				BenchVertex v = {{n.x * 10.0f, n.y * 10.0f, n.z * 10.0f}, {n.x, n.y, n.z}};
+				O.addVertex(v);
+			}
+		}
+		std::vector<unsigned int> quads(rings * segments);
+		for(unsigned int i = 0; i < quads.size(); i++)
+			quads[i] = i;
+		ExRandom Rand(11);
+		for(unsigned int i = quads.size() - 1; i > 0; i--)
+			std::swap(quads[i], quads[Rand.getUInt32() % (i + 1)]);
+		for(unsigned int q : quads) {
+			unsigned int i = (q / segments) * (segments + 1) + q % segments;
+			O.connectQuadrangle(i, i + 1, i + segments + 2, i + segments + 1);
+		}
+	}
+} // namespace
+
+template <>
+inline unsigned int UniformBufferObject<BenchLargeUBO>::getBinding() { return 7; }
+
+int main(int argc, char** argv)
+{
+	std::string filter = "";
+	std::string jsonFile = "";
+	std::string baselineFile = "";
+	double minTime = 0.25;
+	double tolerance = 0.10;
+	for(int i = 1; i + 1 < argc; i += 2) {
+		if(!strcmp(argv[i], "--filter")) filter = argv[i + 1];
+		else if(!strcmp(argv[i], "--min-time")) minTime = atof(argv[i + 1]);
+		else if(!strcmp(argv[i], "--json")) jsonFile = argv[i + 1];
+		else if(!strcmp(argv[i], "--baseline")) baselineFile = argv[i + 1];
+		else if(!strcmp(argv[i], "--tolerance")) tolerance = atof(argv[i + 1]);
+		else {
+			printf("Error: Unknown argument %s\n", argv[i]);
+			return -1;
+		}
+	}
+	Bench::Runner R(filter, minTime);
+	// Correctness checks run regardless of the filter and fail the run
+	unsigned int failedChecks = 0;
+
+	// Commands of all recorders are replayed sorted by key, equal keys in
+	// recorder and then recording order
+	{
+		RenderQueue Q(2, 2);
+		std::vector<int> log;
+		ReplayEntry E[6];
+		for(int i = 0; i < 6; i++)
+			E[i] = {&log, i};
+		UniformBufferObject<BenchLargeUBO> ubo;
+		BenchLargeUBO* large = new BenchLargeUBO();
+		for(uint32_t i = 0; i < 20000; i++)
+			large->values[i] = i * 2654435761u;
+		const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+		SimpleShaderInfo shader;
+		shader.useable = true;
+		for(int frame = 0; frame < 3; frame++) {
+			log.clear();
+			RenderFrame& F = Q.beginRecording();
+			CommandRecorder& A = F.recorder(0);
+			CommandRecorder& B = F.recorder(1);
+			A.callback(3, logReplay, &E[0]);
+			A.callback(1, logReplay, &E[1]);
+			A.updateUniformBuffer(2, ubo, *large);
+			A.setUniform(2, &shader, 0, RenderCommands::UniformType::Mat4, identity);
+			A.callback(3, logReplay, &E[2]);
+			B.viewport(0, 0, 0, 64, 64);
+			B.callback(1, logReplay, &E[3]);
+			B.callback(0, logReplay, &E[4]);
+			B.callback(3, logReplay, &E[5]);
+			Q.endRecording(F);
+			Q.submit();
+			const std::vector<int> expected = {4, 1, 3, 0, 2, 5};
+			if((log != expected) || memcmp(&ubo.read(), large, sizeof(BenchLargeUBO))) {
+				fprintf(stderr, "Check failed: Render commands replayed in the wrong order or with broken payloads\n");
+				failedChecks++;
+				break;
+			}
+		}
+		delete large;
+	}
+
+	// Every meshlet's cone has to contain the normals of its triangles
+	{
+		AttributeLayout L = benchLayout;
+		L.setPositionAttribute("position");
+		BaseGlObject O(L);
+		fillShuffledSphere(O, 64, 128);
+		MeshletSet M;
+		M.build(O);
+		if(unsigned int invalid = M.verify(O)) {
+			fprintf(stderr, "Check failed: %u of %u meshlets of the shuffled sphere have wrong bounds\n", invalid, (unsigned int) M.size());
+			failedChecks++;
+		}
+	}
+
+	// Defines go right after the #version line, followed by a #line that
+	// keeps the numbers of the original lines. Programs with the same file
+	// and defines share the compiled shaders.
+	{
+		const std::filesystem::path file = std::filesystem::temp_directory_path() / "jg_micro_benchmarks_variant.vert";
+		std::ofstream(file) << "// Variant check\n#version 330\nvoid main() {}\n";
+		{
+			ShaderFile F(file.string());
+			const std::string expanded = F.expandVariant("#define USE_A\n#define COUNT 4\n");
+			if(expanded != "// Variant check\n#version 330\n#define USE_A\n#define COUNT 4\n#line 3\nvoid main() {}\n\n") {
+				fprintf(stderr, "Check failed: Variant source expanded to\n%s\n", expanded.c_str());
+				failedChecks++;
+			}
+			SimpleShaderInfo firstInfo;
+			SimpleShaderInfo secondInfo;
+			ShaderProgram first(firstInfo);
+			ShaderProgram second(secondInfo);
+			first.appendShader(&F);
+			second.appendShader(&F);
+			const VariantKey key = first.addDefine("USE_A") | first.addDefine("COUNT 4");
+			second.addDefine("USE_A");
+			second.addDefine("COUNT 4");
+			const SimpleShaderInfo* built = first.variant(key);
+			const unsigned int builtId = built->id;
+			const size_t cached = ShaderCache::size();
+			const uint64_t hits = ShaderCache::hits();
+			const SimpleShaderInfo* again = first.variant(key);
+			second.variant(key);
+			if(!built->useable || (again != built) || (again->id != builtId) || (ShaderCache::size() != cached) ||
+			   (ShaderCache::hits() != hits + 1)) {
+				fprintf(stderr, "Check failed: Shader variants were built again instead of reused\n");
+				failedChecks++;
+			}
+		}
+		std::error_code error;
+		std::filesystem::remove(file, error);
+	}
+
+	// Vertex welding
+	const std::vector<BenchVertex> vertices = makeVertices(20000);
+	R.run("BaseGlObject/addVertexF/untracked", [&]() -> uint64_t {
+		BaseGlObject O(benchLayout);
+		O.disableVertexTracking();
+		for(const BenchVertex& v : vertices)
+			O.addVertex(v);
+		Bench::doNotOptimize(O.sizeVertices());
+		return vertices.size();
+	});
+	for(float epsilon : {0.0f, 0.001f, 0.1f, 1.0f}) {
+		char name[64];
+		snprintf(name, sizeof(name), "BaseGlObject/addVertexF/tracked/eps=%g", epsilon);
+		R.run(name, [&]() -> uint64_t {
+			BaseGlObject O(benchLayout);
+			O.setEpsilon(epsilon);
+			for(const BenchVertex& v : vertices)
+				O.addVertex(v);
+			Bench::doNotOptimize(O.sizeVertices());
+			return vertices.size();
+		});
+	}
+
+	// Mesh construction, one operation is one quad
+	for(bool track : {true, false}) {
+		std::string suffix = track ? "/tracked" : "/untracked";
+		R.run("BaseGlObject/addTriangle/grid128" + suffix, [=]() { return buildGrid(128, false, track); });
+		R.run("BaseGlObject/addQuadrangle/grid128" + suffix, [=]() { return buildGrid(128, true, track); });
+	}
+
+	// The same meshes built in an arena, the allocations reaching the heap
+	// are counted by installing a counting default resource
+	{
+		MemoryArena arena;
+		for(bool track : {true, false}) {
+			std::string suffix = track ? "/tracked/arena" : "/untracked/arena";
+			R.run("BaseGlObject/addQuadrangle/grid128" + suffix, [&, track]() { return buildGrid(128, true, track, &arena); });
+		}
+		CountingResource heap;
+		std::pmr::memory_resource* previous = std::pmr::set_default_resource(&heap);
+		buildGrid(128, true, true);
+		const uint64_t heapAllocations = heap.counters().allocations;
+		std::pmr::set_default_resource(previous);
+		const MemoryArena::Statistics before = arena.statistics();
+		buildGrid(128, true, true, &arena);
+		const MemoryArena::Statistics after = arena.statistics();
+		fprintf(stderr, "%-48s %llu allocations from the heap, %llu with an arena (%llu requests)\n", "BaseGlObject/grid128/tracked",
+				(unsigned long long) heapAllocations, (unsigned long long) (after.heapAllocations - before.heapAllocations),
+				(unsigned long long) (after.allocations + after.nodeAllocations - before.allocations - before.nodeAllocations));
+	}
+
+	// Random numbers
+	const uint64_t randomCount = 1 << 16;
+	ExRandom Rand(1);
+	R.run("ExRandom/getDouble01", [&]() -> uint64_t {
+		double s = 0;
+		for(uint64_t i = 0; i < randomCount; i++)
+			s += Rand.getDouble01();
+		Bench::doNotOptimize(s);
+		return randomCount;
+	});
+	R.run("ExRandom/getUInt32", [&]() -> uint64_t {
+		unsigned int s = 0;
+		for(uint64_t i = 0; i < randomCount; i++)
+			s ^= Rand.getUInt32();
+		Bench::doNotOptimize(s);
+		return randomCount;
+	});
+	R.run("ExRandom/getDoubleNormal", [&]() -> uint64_t {
+		double s = 0;
+		for(uint64_t i = 0; i < randomCount; i++)
+			s += Rand.getDoubleNormal();
+		Bench::doNotOptimize(s);
+		return randomCount;
+	});
+	R.run("ExRandom/getRandomUnitVector3D", [&]() -> uint64_t {
+		double s = 0;
+		for(uint64_t i = 0; i < randomCount; i++)
+			s += Rand.getRandomUnitVector3D().x;
+		Bench::doNotOptimize(s);
+		return randomCount;
+	});
+	for(unsigned int dim : {4u, 16u, 64u}) {
+		R.run("ExRandom/genRandUnitVectorND/dim=" + std::to_string(dim), [&, dim]() -> uint64_t {
+			std::vector<double> vec(dim);
+			for(uint64_t i = 0; i < randomCount / dim; i++)
+				Rand.genRandUnitVectorND(vec.data(), dim);
+			Bench::doNotOptimize(vec[0]);
+			return randomCount / dim;
+		});
+	}
+
+	// Image flipping, one operation is one pixel
+	const unsigned int sizes[][2] = {{256, 256}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+	for(const unsigned int* s : sizes) {
+		unsigned int w = s[0];
+		unsigned int h = s[1];
+		R.run("GLHelper/flipImageY/" + std::to_string(w) + "x" + std::to_string(h), [w, h]() -> uint64_t {
+			static std::vector<unsigned char> pixels;
+			pixels.resize((size_t) w * h * 4, 127);
+			GLHelper::flipImageY(pixels.data(), w, h);
+			Bench::doNotOptimize(pixels[0]);
+			return (uint64_t) w * h;
+		});
+	}
+
+	// Frustum culling, one operation is one sphere
+	{
+		glm::mat4 P(0.0f);
+		P[0][0] = 1;
+		P[1][1] = 1;
+		P[2][2] = -1.002f;
+		P[2][3] = -1;
+		P[3][2] = -0.2002f;
+		const Culling::Frustum F = Culling::extractFrustum(P);
+		ExRandom Rand(3);
+		std::vector<glm::vec4> spheres(100000);
+		Culling::SphereSet S;
+		for(glm::vec4& s : spheres) {
+			s = glm::vec4(glm::vec3(Rand.getRandomUnitVector3D() * (Rand.getDouble01() * 200.0)), 0.5f);
+			S.add(s);
+		}
+		Culling::BVH B;
+		B.build(spheres);
+		std::vector<unsigned int> visible;
+		R.run("Culling/cullSpheres/100000", [&]() -> uint64_t {
+			visible.clear();
+			Culling::cullSpheres(F, S, visible);
+			Bench::doNotOptimize(visible.size());
+			return spheres.size();
+		});
+		R.run("Culling/BVH/query/100000", [&]() -> uint64_t {
+			visible.clear();
+			B.query(F, visible);
+			Bench::doNotOptimize(visible.size());
+			return spheres.size();
+		});
+	}
+
+	// Meshlets of a wavy 256x256 grid, one operation is one
+	// triangle for building and one meshlet for culling
+	{
+		AttributeLayout L = benchLayout;
+		L.setPositionAttribute("position");
+		BaseGlObject O(L);
+		O.disableVertexTracking();
+		const unsigned int size = 256;
+		for(unsigned int x = 0; x <= size; x++) {
+			for(unsigned int z = 0; z <= size; z++) {
+				BenchVertex v = {{(float) x, std::sin(x * 0.1f) * std::cos(z * 0.1f) * 8.0f, (float) z}, {0, 1, 0}};
+				O.addVertex(v);
+			}
+		}
+		for(unsigned int x = 0; x < size; x++) {
+			for(unsigned int z = 0; z < size; z++) {
+				unsigned int i = x * (size + 1) + z;
+				O.connectQuadrangle(i, i + 1, i + size + 2, i + size + 1);
+			}
+		}
+		const uint64_t triangles = O.sizeIndeces() / 3;
+		MeshletSet M;
+		R.run("Meshlets/build/grid256", [&]() -> uint64_t {
+			M.build(O);
+			Bench::doNotOptimize(M.size());
+			return triangles;
+		});
+		Culling::Frustum F;
+		for(glm::vec4& p : F.planes)
+			p = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		std::vector<unsigned int> visible;
+		R.run("Meshlets/cull/grid256", [&]() -> uint64_t {
+			visible.clear();
+			M.cull(F, glm::vec3(128.0f, 4.0f, 128.0f), visible);
+			Bench::doNotOptimize(visible.size());
+			return M.size();
+		});
+	}
+
+	// Streaming churn, one operation drops and uploads a mesh again
+	// Frames end every 64 uploads, so the pools get refilled
+	{
+		BaseGlObject O(benchLayout);
+		O.disableVertexTracking();
+		for(const BenchVertex& v : makeVertices(17 * 17))
+			O.addVertex(v);
+		for(unsigned int x = 0; x < 16; x++) {
+			for(unsigned int z = 0; z < 16; z++) {
+				unsigned int i = x * 17 + z;
+				O.connectQuadrangle(i, i + 1, i + 18, i + 17);
+			}
+		}
+		R.run("GLResources/reupload/grid16", [&]() -> uint64_t {
+			for(unsigned int i = 0; i < 1024; i++) {
+				O.clearDataFromGraphicsCard();
+				O.copyDataToGraphicsCard();
+				if(i % 64 == 63) GLResources::endFrame();
+			}
+			return 1024;
+		});
+		O.clearDataFromGraphicsCard();
+		GLResources::clear();
+	}
+
+	// Perlin noise tables
+	R.run("GlobalUBOs/construct", []() -> uint64_t {
+		GlobalUBOs U;
+		Bench::doNotOptimize(U.perlinNoise().read().hash[0]);
+		return 1;
+	});
+
+	if(jsonFile != "") {
+		FILE* f = fopen(jsonFile.c_str(), "w");
+		if(f == nullptr) {
+			printf("Error: Can't open %s for writing!\n", jsonFile.c_str());
+			return -1;
+		}
+		R.writeJSON(f);
+		fclose(f);
+	} else {
+		R.writeJSON(stdout);
+	}
+	if(failedChecks > 0) return -1;
+	if(baselineFile != "") {
+		return Bench::compare(R.getResults(), Bench::readJSON(baselineFile), tolerance);
+	}
+	return 0;
+}
@@ -5,6 +5,10 @@
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include "../util/GLResources.h"
+#include "../util/MemoryStats.h"
+#include "../util/Profiler.h"
+
 #define UBO_TRANSFORM_BINDING       0
 #define UBO_PERLIN_NOISE_BINDING    1
 
@@ -66,13 +70,15 @@ UniformBufferObject<T>::UniformBufferObject() :
 	glGenBuffers(1, &id);
 	bind();
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_STATIC_DRAW);
+	MemoryStats::allocate(MemoryStats::Category::UniformBuffer, sizeof(T));
 }
 
 template <typename T>
 UniformBufferObject<T>::~UniformBufferObject()
 {
-	// Delete the ubo
-	glDeleteBuffers(1, &id);
+	// Delete the ubo once no frame in flight reads it
+	GLResources::deleteLater(GLResources::Object::Buffer, id);
+	MemoryStats::release(MemoryStats::Category::UniformBuffer, sizeof(T));
 }
 
 template <typename T>
@@ -85,9 +91,12 @@ inline void UniformBufferObject<T>::bind()
 template <typename T>
 void UniformBufferObject<T>::update()
 {
+	PROFILE_CPU_ZONE("UniformBufferObject::update");
 	bind();
+	PROFILE_COUNT_BINDS(2);
 	if(dirty) {
 		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &ubo);
+		PROFILE_COUNT_UPLOAD(sizeof(T));
 		dirty = false;
 	}
 }
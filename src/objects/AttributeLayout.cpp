@@ -0,0 +1,146 @@
+#include "AttributeLayout.h"
+
+#include <cstring>
+
+AttributeLocation::AttributeLocation() :
+	size(0),
+	offsetInStruct(0),
+	offsetInGL(0),
+	stream(0),
+	offsetInStream(0),
+	name(nullptr)
+{}
+
+AttributeLocation::AttributeLocation(const AttributeLocation& ALoc) :
+	size(ALoc.size),
+	offsetInStruct(ALoc.offsetInStruct),
+	offsetInGL(ALoc.offsetInGL),
+	stream(ALoc.stream),
+	offsetInStream(ALoc.offsetInStream),
+	name(ALoc.name)
+{}
+
+AttributeLocation::AttributeLocation(const char* name_, unsigned int size_, unsigned int offset_) :
+	size(size_),
+	offsetInStruct(offset_),
+	offsetInGL(0),
+	stream(0),
+	offsetInStream(0),
+	name(name_)
+{}
+
+AttributeLayout::AttributeLayout() :
+	Attributes(0),
+	totalSize(0),
+	positionAttribute(-1),
+	streamSizes{0, 0}
+{}
+
+AttributeLayout::AttributeLayout(const AttributeLocation& ALoc) :
+	AttributeLayout()
+{
+	append(ALoc);
+}
+
+AttributeLayout::AttributeLayout(const AttributeLayout& ALay) :
+	Attributes(ALay.Attributes),
+	totalSize(ALay.totalSize),
+	positionAttribute(ALay.positionAttribute),
+	streamSizes{ALay.streamSizes[0], ALay.streamSizes[1]}
+{}
+
+AttributeLayout::AttributeLayout(std::pmr::memory_resource* memory) :
+	Attributes(memory),
+	totalSize(0),
+	positionAttribute(-1),
+	streamSizes{0, 0}
+{}
+
+AttributeLayout::AttributeLayout(const AttributeLayout& ALay, std::pmr::memory_resource* memory) :
+	Attributes(ALay.Attributes, memory),
+	totalSize(ALay.totalSize),
+	positionAttribute(ALay.positionAttribute),
+	streamSizes{ALay.streamSizes[0], ALay.streamSizes[1]}
+{}
+
+AttributeLayout::~AttributeLayout()
+{}
+
+void AttributeLayout::append(const AttributeLocation& ALoc)
+{
+	unsigned int h = totalSize;
+	totalSize += ALoc.size;
+	Attributes.push_back(ALoc);
+	Attributes[Attributes.size() - 1].offsetInGL = h;
+	Attributes[Attributes.size() - 1].stream = STREAM_INTERLEAVED;
+	updateStreamOffsets();
+}
+
+bool AttributeLayout::setPositionAttribute(const char* name)
+{
+	for(unsigned int i = 0; i < Attributes.size(); i++) {
+		if(strcmp(Attributes[i].name, name)) continue;
+		if((Attributes[i].size < 2) || (Attributes[i].size > 3)) return false;
+		positionAttribute = i;
+		return true;
+	}
+	return false;
+}
+
+void AttributeLayout::updateStreamOffsets()
+{
+	streamSizes[STREAM_INTERLEAVED] = 0;
+	streamSizes[STREAM_SEPARATE] = 0;
+	for(AttributeLocation& A : Attributes) {
+		A.offsetInStream = streamSizes[A.stream];
+		streamSizes[A.stream] += A.size;
+	}
+}
+
+bool AttributeLayout::setSeparateStream(const char* name)
+{
+	for(AttributeLocation& A : Attributes) {
+		if(strcmp(A.name, name)) continue;
+		A.stream = STREAM_SEPARATE;
+		updateStreamOffsets();
+		return true;
+	}
+	return false;
+}
+
+bool AttributeLayout::separatePosition()
+{
+	if(!hasPosition()) return false;
+	return setSeparateStream(Attributes[positionAttribute].name);
+}
+
+void AttributeLayout::splitStreams(const std::pmr::vector<float>& vertices, std::pmr::vector<float>& interleaved, std::pmr::vector<float>& separate) const
+{
+	size_t count = totalSize ? vertices.size() / totalSize : 0;
+	interleaved.resize(count * streamSizes[STREAM_INTERLEAVED]);
+	separate.resize(count * streamSizes[STREAM_SEPARATE]);
+	float* streams[2] = {interleaved.data(), separate.data()};
+	for(size_t v = 0; v < count; v++) {
+		const float* src = &vertices[v * totalSize];
+		for(const AttributeLocation& A : Attributes) {
+			float* dst = streams[A.stream] + v * streamSizes[A.stream] + A.offsetInStream;
+			for(unsigned int i = 0; i < A.size; i++)
+				dst[i] = src[A.offsetInGL + i];
+		}
+	}
+}
+
+void AttributeLayout::mergeStreams(const std::pmr::vector<float>& interleaved, const std::pmr::vector<float>& separate, std::pmr::vector<float>& vertices) const
+{
+	size_t count = streamSizes[STREAM_SEPARATE] ? separate.size() / streamSizes[STREAM_SEPARATE] : 0;
+	vertices.resize(count * totalSize);
+	const float* streams[2] = {interleaved.data(), separate.data()};
+	for(size_t v = 0; v < count; v++) {
+		float* dst = &vertices[v * totalSize];
+		for(const AttributeLocation& A : Attributes) {
+			const float* src = streams[A.stream] + v * streamSizes[A.stream] + A.offsetInStream;
+			for(unsigned int i = 0; i < A.size; i++)
+				dst[A.offsetInGL + i] = src[i];
+		}
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef ATTRIBUTE_LAYOUT_H_DEFINED
+#define ATTRIBUTE_LAYOUT_H_DEFINED
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+// How to read an attribute from a struct
+// And how to map it to the OpenGL arrays
+// All sizes for floats
+struct AttributeLocation {
+	unsigned int size;
+	unsigned int offsetInStruct;
+	// Offset in the interleaved vertex kept on the CPU
+	unsigned int offsetInGL;
+	// Vertex buffer the attribute is stored in on the graphics card
+	// and the offset in a vertex of that buffer
+	unsigned int stream;
+	unsigned int offsetInStream;
+	const char* name;
+	AttributeLocation();
+	AttributeLocation(const AttributeLocation& ALoc);
+	AttributeLocation(const char* name_, unsigned int size_, unsigned int offset_);
+};
+
+// A shortcut for constructing an AttributeLocation
+// This will only need the name of the struct and name of
+// the struct memeber to get the size and offset of the
+// member in the struct.
+// The name of the attribute will be the same as the name
+// of the struct member.
+#define ATTRIB_LOC(STRUCT_NAME, MEMBER_NAME) AttributeLocation(#MEMBER_NAME,                                                  \
+															   sizeof(((STRUCT_NAME*) nullptr)->MEMBER_NAME) / sizeof(float), \
+															   offsetof(struct STRUCT_NAME, MEMBER_NAME) / sizeof(float))
+
+// Full description of all attributes for an object
+// On the CPU all attributes are interleaved. On the graphics card
+// attributes moved to the separate stream are stored tightly packed
+// in their own buffer, so passes that only need them (depth, shadows)
+// don't fetch the rest of the vertex.
+class AttributeLayout {
+  private:
+	std::pmr::vector<AttributeLocation> Attributes;
+	unsigned int totalSize;
+	// Index of the attribute holding the position, -1 if none
+	int positionAttribute;
+	// Size of a vertex in each stream
+	unsigned int streamSizes[2];
+	void updateStreamOffsets();
+
+  public:
+	AttributeLayout();
+	AttributeLayout(const AttributeLocation& ALoc);
+	AttributeLayout(const AttributeLayout& ALay);
+	// Empty or copied layout allocating from the given resource
+	explicit AttributeLayout(std::pmr::memory_resource* memory);
+	AttributeLayout(const AttributeLayout& ALay, std::pmr::memory_resource* memory);
+	~AttributeLayout();
+	// Add an Attribute Location and increase the size
+	void append(const AttributeLocation& ALoc);
+	// Access to the size
+	inline unsigned int size() const { return totalSize; };
+	// Access to attributes
+	inline const std::pmr::vector<AttributeLocation>& getAttributes() const { return Attributes; };
+	// Select the attribute used for bounding volumes by its name
+	// It needs to have 2 or 3 floats
+	bool setPositionAttribute(const char* name);
+	inline bool hasPosition() const { return positionAttribute >= 0; };
+	inline const AttributeLocation& getPosition() const { return Attributes[positionAttribute]; };
+	// Streams on the graphics card
+	static constexpr unsigned int STREAM_INTERLEAVED = 0;
+	static constexpr unsigned int STREAM_SEPARATE = 1;
+	// Move an attribute to the separate stream by its name
+	bool setSeparateStream(const char* name);
+	// Move the position attribute to the separate stream
+	bool separatePosition();
+	inline bool hasSeparateStream() const { return streamSizes[STREAM_SEPARATE] > 0; };
+	inline unsigned int streamSize(unsigned int stream) const { return streamSizes[stream]; };
+	// Split interleaved vertices into the two streams and back
+	void splitStreams(const std::pmr::vector<float>& vertices, std::pmr::vector<float>& interleaved, std::pmr::vector<float>& separate) const;
+	void mergeStreams(const std::pmr::vector<float>& interleaved, const std::pmr::vector<float>& separate, std::pmr::vector<float>& vertices) const;
+};
+
+// Allow for an easy definition of an AttributeLayout by adding AttributeLocations
+// Add two AttributeLocations resulting in an AttributeLayout
+inline AttributeLayout operator+(const AttributeLocation& A, const AttributeLocation& B)
+{
+	AttributeLayout R(A);
+	R.append(B);
+	return R;
+}
+
+// Add an AtributeLocation to an AttributeLayout resulting in a AttributeLayout
+// This is needed when we are adding more then two AttributeLocations
+inline AttributeLayout operator+(const AttributeLayout& A, const AttributeLocation& B)
+{
+	AttributeLayout R(A);
+	R.append(B);
+	return R;
+}
+
+#endif
@@ -1,52 +1,21 @@
 #include "BaseGlObject.h"
 
-AttributeLocation::AttributeLocation() :
-	size(0),
-	offsetInStruct(0),
-	offsetInGL(0),
-	name(nullptr)
-{}
-
-AttributeLocation::AttributeLocation(const AttributeLocation& ALoc) :
-	size(ALoc.size),
-	offsetInStruct(ALoc.offsetInStruct),
-	offsetInGL(ALoc.offsetInGL),
-	name(ALoc.name)
-{}
-
-AttributeLocation::AttributeLocation(const char* name_, unsigned int size_, unsigned int offset_) :
-	size(size_),
-	offsetInStruct(offset_),
-	offsetInGL(0),
-	name(name_)
-{}
-
-AttributeLayout::AttributeLayout() :
-	Attributes(0),
-	totalSize(0)
-{}
-
-AttributeLayout::AttributeLayout(const AttributeLocation& ALoc) :
-	AttributeLayout()
-{
-	append(ALoc);
-}
+#include <algorithm>
 
-AttributeLayout::AttributeLayout(const AttributeLayout& ALay) :
-	Attributes(ALay.Attributes),
-	totalSize(ALay.totalSize)
-{}
+#include "../util/GLHelper.h"
+#include "../util/GLResources.h"
+#include "../util/MemoryStats.h"
+#include "../util/Profiler.h"
 
-AttributeLayout::~AttributeLayout()
-{}
+namespace {
+	std::pmr::memory_resource* orDefault(std::pmr::memory_resource* memory)
+	{
+		return memory ? memory : std::pmr::get_default_resource();
+	}
 
-void AttributeLayout::append(const AttributeLocation& ALoc)
-{
-	unsigned int h = totalSize;
-	totalSize += ALoc.size;
-	Attributes.push_back(ALoc);
-	Attributes[Attributes.size() - 1].offsetInGL = h;
-}
+	// A map node holds the pair, three pointers and the color
+	const int64_t trackerNodeBytes = sizeof(std::pair<const int64_t, size_t>) + 4 * sizeof(void*);
+} // namespace
 
 IndexedTriangle::IndexedTriangle() :
 	IndexedTriangle(0, 0, 0)
@@ -81,22 +50,20 @@ bool BaseGlObject::adaptToShader()
 		glBindVertexArray(vao);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
+		if(Layout.hasSeparateStream()) {
+			// Several vertex buffers, bound by binding points
+			bindVertexBuffers(false);
+			if(!bindAttributeFormats(Layout, lastAdaptedShader, false, false)) return false;
+			if(InstanceLayout.size() && !bindAttributeFormats(InstanceLayout, lastAdaptedShader, true, false)) return false;
+			shaderCompatible = true;
+			return true;
+		}
 		// Define how each attribute should be interpreted
-		for(const AttributeLocation& A : Layout.getAttributes()) {
-			unsigned int loc = glGetAttribLocation(lastAdaptedShader, A.name);
-			if(loc == ((unsigned int) -1)) {
-				// This attribute does not exist
-				printf("%s does not exist as an attribute for the shader!\n", A.name);
-				return false;
-			}
-			glEnableVertexAttribArray(loc);
-			glVertexAttribPointer(
-				loc,                                     // index
-				A.size,                                  // size
-				GL_FLOAT,                                // type
-				GL_FALSE,                                // normalized
-				sizeof(float) * Layout.size(),           // stride
-				(void*) (sizeof(float) * A.offsetInGL)); // offset
+		if(!bindAttributes(Layout, 0)) return false;
+		// Per instance attributes advance once per instance
+		if(InstanceLayout.size()) {
+			glBindBuffer(GL_ARRAY_BUFFER, ibo);
+			if(!bindAttributes(InstanceLayout, 1)) return false;
 		}
 		shaderCompatible = true;
 		return true;
@@ -106,29 +73,134 @@ bool BaseGlObject::adaptToShader()
 	return false;
 }
 
-BaseGlObject::BaseGlObject(const AttributeLayout& L) :
-	Layout(L),
+bool BaseGlObject::bindAttributes(const AttributeLayout& L, unsigned int divisor)
+{
+	for(const AttributeLocation& A : L.getAttributes()) {
+		unsigned int loc = glGetAttribLocation(lastAdaptedShader, A.name);
+		if(loc == ((unsigned int) -1)) {
+			// This attribute does not exist
+			printf("%s does not exist as an attribute for the shader!\n", A.name);
+			return false;
+		}
+		// Attributes with more than 4 floats (matrices)
+		// span several consecutive locations
+		for(unsigned int col = 0; col * 4 < A.size; col++) {
+			unsigned int colSize = std::min(4u, A.size - col * 4);
+			glEnableVertexAttribArray(loc + col);
+			glVertexAttribPointer(
+				loc + col,                                          // index
+				colSize,                                            // size
+				GL_FLOAT,                                           // type
+				GL_FALSE,                                           // normalized
+				sizeof(float) * L.size(),                           // stride
+				(void*) (sizeof(float) * (A.offsetInGL + col * 4))); // offset
+			glVertexAttribDivisor(loc + col, divisor);
+		}
+	}
+	return true;
+}
+
+bool BaseGlObject::bindAttributeFormats(const AttributeLayout& L, unsigned int shader, bool instances, bool positionsOnly)
+{
+	unsigned int bound = 0;
+	for(const AttributeLocation& A : L.getAttributes()) {
+		if(positionsOnly && !instances && Layout.hasSeparateStream() && (A.stream != AttributeLayout::STREAM_SEPARATE)) continue;
+		unsigned int loc = glGetAttribLocation(shader, A.name);
+		if(loc == ((unsigned int) -1)) {
+			// A depth shader doesn't need every attribute
+			if(positionsOnly) continue;
+			printf("%s does not exist as an attribute for the shader!\n", A.name);
+			return false;
+		}
+		unsigned int binding = instances ? BINDING_INSTANCES : A.stream;
+		unsigned int offset = instances ? A.offsetInGL : A.offsetInStream;
+		for(unsigned int col = 0; col * 4 < A.size; col++) {
+			unsigned int colSize = std::min(4u, A.size - col * 4);
+			glEnableVertexAttribArray(loc + col);
+			glVertexAttribFormat(loc + col, colSize, GL_FLOAT, GL_FALSE, sizeof(float) * (offset + col * 4));
+			glVertexAttribBinding(loc + col, binding);
+		}
+		bound++;
+	}
+	// Instance attributes are optional for a position only shader
+	return bound || instances || !positionsOnly;
+}
+
+void BaseGlObject::bindVertexBuffers(bool positionsOnly)
+{
+	if(Layout.hasSeparateStream()) {
+		unsigned int s = Layout.streamSize(AttributeLayout::STREAM_INTERLEAVED);
+		if(!positionsOnly && s) glBindVertexBuffer(AttributeLayout::STREAM_INTERLEAVED, vbo, 0, sizeof(float) * s);
+		s = Layout.streamSize(AttributeLayout::STREAM_SEPARATE);
+		glBindVertexBuffer(AttributeLayout::STREAM_SEPARATE, svbo, 0, sizeof(float) * s);
+	} else {
+		glBindVertexBuffer(AttributeLayout::STREAM_INTERLEAVED, vbo, 0, sizeof(float) * Layout.size());
+	}
+	if(InstanceLayout.size()) {
+		glBindVertexBuffer(BINDING_INSTANCES, ibo, 0, sizeof(float) * InstanceLayout.size());
+		glVertexBindingDivisor(BINDING_INSTANCES, 1);
+	}
+}
+
+BaseGlObject::BaseGlObject(const AttributeLayout& L, const AttributeLayout& I, std::pmr::memory_resource* memory, std::pmr::memory_resource* trackerMemory) :
+	Layout(L, orDefault(memory)),
+	InstanceLayout(I, orDefault(memory)),
 	numberOfVertices(0),
 	numberOfIndices(0),
-	vertexData(0),
-	indexData(0),
+	vertexData(orDefault(memory)),
+	indexData(orDefault(memory)),
 	graphicsCardStatus(0),
 	lastAdaptedShader((unsigned int) -1),
 	shaderCompatible(false),
 	shaderInfo(nullptr),
 	vao(0),
 	vbo(0),
+	eab(0),
+	svbo(0),
+	positionVao(0),
+	lastPositionShader((unsigned int) -1),
+	positionShaderCompatible(false),
+	numberOfInstances(0),
+	instanceData(orDefault(memory)),
+	ibo(0),
+	instanceCapacity(0),
+	dirtyInstancesBegin(0),
+	dirtyInstancesEnd(0),
 	trackVertices(true),
 	vertexTracker([this](int64_t l, int64_t r) -> bool {
 		return compareVertices(l, r);
-	}),
+	}, orDefault(trackerMemory ? trackerMemory : memory)),
 	newVertexPointer(nullptr),
-	vertexEpsilon(0.001f)
-{}
+	vertexEpsilon(0.001f),
+	boundsMin(0.0f),
+	boundsMax(0.0f),
+	boundingSphere(0.0f),
+	residency(MeshResidency::KeepAll),
+	cpuDataResident(true),
+	trackerResident(true),
+	accountedVertexBytes(0),
+	accountedIndexBytes(0),
+	accountedTrackerBytes(0),
+	accountedInstanceBytes(0),
+	gpuVertexBytes(0),
+	gpuIndexBytes(0),
+	gpuInstanceBytes(0)
+{
+	MemoryStats::allocate(MemoryStats::Category::CpuVertices, 0);
+	MemoryStats::allocate(MemoryStats::Category::CpuIndices, 0);
+	MemoryStats::allocate(MemoryStats::Category::CpuTracker, 0);
+	MemoryStats::allocate(MemoryStats::Category::CpuInstances, 0);
+}
 
 BaseGlObject::~BaseGlObject()
 {
+	// No need to read dropped data back before deleting the buffers
+	cpuDataResident = true;
 	clearDataFromGraphicsCard();
+	MemoryStats::release(MemoryStats::Category::CpuVertices, accountedVertexBytes);
+	MemoryStats::release(MemoryStats::Category::CpuIndices, accountedIndexBytes);
+	MemoryStats::release(MemoryStats::Category::CpuTracker, accountedTrackerBytes);
+	MemoryStats::release(MemoryStats::Category::CpuInstances, accountedInstanceBytes);
 	// Currently we aren't allocation
 	// any other data explicitely, but
 	// have the vectors deal with it
@@ -136,9 +208,10 @@ BaseGlObject::~BaseGlObject()
 
 unsigned int BaseGlObject::addVertexF(const float* v)
 {
+	if(!cpuDataResident || !trackerResident) ensureCpuData();
 	if(trackVertices) {
 		newVertexPointer = v;
-		std::map<int64_t, size_t>::iterator it = vertexTracker.find(-1);
+		VertexTracker::iterator it = vertexTracker.find(-1);
 		newVertexPointer = nullptr;
 		if(it != vertexTracker.end()) {
 			//printf("Found vertex at %d\n", (int) it->second);
@@ -155,14 +228,50 @@ unsigned int BaseGlObject::addVertexF(const float* v)
 	if(trackVertices) {
 		vertexTracker.insert(std::pair<int64_t, size_t>(num, num));
 	}
+	expandBounds(num);
 	return num;
 }
 
+void BaseGlObject::expandBounds(unsigned int index)
+{
+	if(!Layout.hasPosition()) return;
+	const AttributeLocation& P = Layout.getPosition();
+	const float* p = &vertexData[index * Layout.size() + P.offsetInGL];
+	glm::vec3 v(p[0], p[1], (P.size > 2) ? p[2] : 0.0f);
+	if(index == 0) {
+		boundsMin = boundsMax = v;
+		boundingSphere = glm::vec4(v, 0.0f);
+		return;
+	}
+	for(int i = 0; i < 3; i++) {
+		if(v[i] < boundsMin[i]) boundsMin[i] = v[i];
+		if(v[i] > boundsMax[i]) boundsMax[i] = v[i];
+	}
+	// If the vertex is outside of the sphere move the sphere
+	// towards it and grow it just enough to contain both
+	glm::vec3 center(boundingSphere.x, boundingSphere.y, boundingSphere.z);
+	float d = glm::length(v - center);
+	if(d > boundingSphere.w) {
+		float r = (boundingSphere.w + d) * 0.5f;
+		center = center + (v - center) * ((r - boundingSphere.w) / d);
+		boundingSphere = glm::vec4(center, r);
+	}
+}
+
+void BaseGlObject::recomputeBounds()
+{
+	if(!Layout.hasPosition()) return;
+	for(unsigned int i = 0; i < numberOfVertices; i++) {
+		expandBounds(i);
+	}
+}
+
 void BaseGlObject::connectTriangle(
 	unsigned int indexA,
 	unsigned int indexB,
 	unsigned int indexC)
 {
+	if(!cpuDataResident) ensureCpuData();
 	indexData.push_back(indexA);
 	indexData.push_back(indexB);
 	indexData.push_back(indexC);
@@ -205,6 +314,29 @@ void BaseGlObject::addQuadrangleF(
 	connectTriangle(va, vc, vd);
 }
 
+bool BaseGlObject::takeMesh(MeshBuilder&& M)
+{
+	if(M.Layout.size() != Layout.size()) return false;
+	vertexData = std::move(M.vertexData);
+	indexData = std::move(M.indexData);
+	numberOfVertices = M.numberOfVertices;
+	numberOfIndices = M.numberOfIndices;
+	M.vertexData.clear();
+	M.indexData.clear();
+	M.numberOfVertices = 0;
+	M.numberOfIndices = 0;
+	M.resetTracker();
+	cpuDataResident = true;
+	trackerResident = true;
+	recomputeBounds();
+	// Filling the map again would cost more than
+	// building the mesh on other threads saved
+	disableVertexTracking();
+	if(graphicsCardStatus == 1) graphicsCardStatus = -1;
+	updateMemoryStats();
+	return true;
+}
+
 bool BaseGlObject::copyDataToGraphicsCard()
 {
 	switch(graphicsCardStatus) {
@@ -216,27 +348,57 @@ bool BaseGlObject::copyDataToGraphicsCard()
 			// Delete the outdated data first
 			clearDataFromGraphicsCard();
 		case 0:
+			PROFILE_CPU_ZONE("BaseGlObject::copyDataToGraphicsCard");
 			// Copy the data onto the graphics card
-			// VAO
-			glGenVertexArrays(1, &vao);
-			glBindVertexArray(vao);
+			// VAO, the buffers and the vao come from the pools
+			// so streamed objects reuse them instead of creating new ones
+			vao = GLResources::acquireVertexArray();
 			// VBO
 			unsigned int datasize = sizeof(float) * numberOfVertices * Layout.size();
-			glGenBuffers(1, &vbo);
-			glBindBuffer(GL_ARRAY_BUFFER, vbo);
-			if(vertexData.size()) {
-				glBufferData(GL_ARRAY_BUFFER, datasize, &vertexData[0], GL_STATIC_DRAW);
+			if(Layout.hasSeparateStream()) {
+				// Split the vertices into the two streams
+				std::pmr::vector<float> interleaved;
+				std::pmr::vector<float> separate;
+				Layout.splitStreams(vertexData, interleaved, separate);
+				vbo = GLResources::acquireBuffer(GL_ARRAY_BUFFER, sizeof(float) * interleaved.size(), GL_STATIC_DRAW);
+				if(interleaved.size()) glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * interleaved.size(), &interleaved[0]);
+				svbo = GLResources::acquireBuffer(GL_ARRAY_BUFFER, sizeof(float) * separate.size(), GL_STATIC_DRAW);
+				if(separate.size()) glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * separate.size(), &separate[0]);
+				if(vertexData.size()) {
+					PROFILE_COUNT_UPLOAD(datasize);
+				}
+			} else {
+				vbo = GLResources::acquireBuffer(GL_ARRAY_BUFFER, datasize, GL_STATIC_DRAW);
+				if(vertexData.size()) {
+					glBufferSubData(GL_ARRAY_BUFFER, 0, datasize, &vertexData[0]);
+					PROFILE_COUNT_UPLOAD(datasize);
+				}
 			}
+			gpuVertexBytes = vertexData.size() ? datasize : 0;
+			MemoryStats::allocate(MemoryStats::Category::VertexBuffer, gpuVertexBytes);
 			// EAB
 			datasize = sizeof(unsigned int) * numberOfIndices;
-			glGenBuffers(1, &eab);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
+			eab = GLResources::acquireBuffer(GL_ELEMENT_ARRAY_BUFFER, datasize, GL_STATIC_DRAW);
 			if(indexData.size()) {
-				glBufferData(GL_ELEMENT_ARRAY_BUFFER, datasize, &indexData[0], GL_STATIC_DRAW);
+				glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, datasize, &indexData[0]);
+				PROFILE_COUNT_UPLOAD(datasize);
+			}
+			gpuIndexBytes = indexData.size() ? datasize : 0;
+			MemoryStats::allocate(MemoryStats::Category::IndexBuffer, gpuIndexBytes);
+			// IBO, the instances are uploaded before drawing
+			if(InstanceLayout.size()) {
+				glGenBuffers(1, &ibo);
+				instanceCapacity = 0;
+				gpuInstanceBytes = 0;
+				MemoryStats::allocate(MemoryStats::Category::InstanceBuffer, 0);
+				markInstancesDirty(0, numberOfInstances);
 			}
 			// Mark the shader as unusable as vao vbo and eab have changed
 			lastAdaptedShader = (unsigned int) -1;
+			lastPositionShader = (unsigned int) -1;
 			graphicsCardStatus = 1;
+			applyResidency();
+			updateMemoryStats();
 			return true;
 	}
 	// This should be unreachable
@@ -246,12 +408,23 @@ bool BaseGlObject::copyDataToGraphicsCard()
 bool BaseGlObject::clearDataFromGraphicsCard()
 {
 	if(graphicsCardStatus) {
-		// I'm not sure if the order of these
-		// matter but deleting them in reverse
-		// order seems like the safest way
-		glDeleteBuffers(1, &vbo);
-		glDeleteBuffers(1, &eab);
-		glDeleteVertexArrays(1, &vao);
+		// Without a CPU copy the data would be lost
+		if(!cpuDataResident) ensureCpuData();
+		MemoryStats::release(MemoryStats::Category::VertexBuffer, gpuVertexBytes);
+		MemoryStats::release(MemoryStats::Category::IndexBuffer, gpuIndexBytes);
+		if(InstanceLayout.size()) MemoryStats::release(MemoryStats::Category::InstanceBuffer, gpuInstanceBytes);
+		gpuVertexBytes = gpuIndexBytes = gpuInstanceBytes = 0;
+		// Frames in flight might still use them, so they are only
+		// deleted or reused once those are done. The instance buffer
+		// changes its size and isn't pooled.
+		if(InstanceLayout.size()) GLResources::deleteLater(GLResources::Object::Buffer, ibo);
+		GLResources::releaseBuffer(svbo);
+		GLResources::releaseBuffer(vbo);
+		GLResources::releaseBuffer(eab);
+		GLResources::releaseVertexArray(positionVao);
+		GLResources::releaseVertexArray(vao);
+		svbo = 0;
+		positionVao = 0;
 		graphicsCardStatus = 0;
 		return true;
 	}
@@ -264,7 +437,7 @@ bool BaseGlObject::setShader(const SimpleShaderInfo* shader)
 	return adaptToShader();
 }
 
-bool BaseGlObject::drawObject()
+bool BaseGlObject::prepareDraw()
 {
 	// If the shader is usable and hasn't changed we can draw the
 	// object, otherwise we first need to check if a shader is even
@@ -280,13 +453,213 @@ bool BaseGlObject::drawObject()
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
 		// Select the shader
 		glUseProgram(lastAdaptedShader);
-		// Indexed drawing
-		glDrawElements(GL_TRIANGLES, numberOfIndices, GL_UNSIGNED_INT, (void*) 0);
+		PROFILE_COUNT_BINDS(4);
 		return true;
 	}
 	return false;
 }
 
+bool BaseGlObject::preparePositionDraw(const SimpleShaderInfo* shader)
+{
+	if((graphicsCardStatus == 0) || (shader == nullptr) || !shader->useable) return false;
+	if(lastPositionShader != shader->id) {
+		lastPositionShader = shader->id;
+		// Start from a fresh vao so no attributes of
+		// the previous shader stay enabled
+		GLResources::releaseVertexArray(positionVao);
+		positionVao = GLResources::acquireVertexArray();
+		glBindVertexArray(positionVao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
+		bindVertexBuffers(true);
+		positionShaderCompatible = bindAttributeFormats(Layout, shader->id, false, true);
+		if(positionShaderCompatible && InstanceLayout.size()) {
+			positionShaderCompatible = bindAttributeFormats(InstanceLayout, shader->id, true, true);
+		}
+		if(!positionShaderCompatible) printf("The shader reads no attributes of the separate stream!\n");
+	}
+	if(!positionShaderCompatible) return false;
+	glBindVertexArray(positionVao);
+	glUseProgram(shader->id);
+	PROFILE_COUNT_BINDS(2);
+	return true;
+}
+
+bool BaseGlObject::drawObject()
+{
+	PROFILE_CPU_ZONE("BaseGlObject::drawObject");
+	if(!prepareDraw()) return false;
+	// Indexed drawing
+	glDrawElements(GL_TRIANGLES, numberOfIndices, GL_UNSIGNED_INT, (void*) 0);
+	PROFILE_COUNT_DRAW(numberOfIndices / 3);
+	return true;
+}
+
+bool BaseGlObject::drawObjectInstanced()
+{
+	PROFILE_CPU_ZONE("BaseGlObject::drawObjectInstanced");
+	if(!InstanceLayout.size()) return false;
+	if(!prepareDraw()) return false;
+	uploadInstances();
+	if(numberOfInstances == 0) return true;
+	// Indexed drawing of all instances at once
+	glDrawElementsInstanced(GL_TRIANGLES, numberOfIndices, GL_UNSIGNED_INT, (void*) 0, numberOfInstances);
+	PROFILE_COUNT_DRAW((uint64_t) (numberOfIndices / 3) * numberOfInstances);
+	return true;
+}
+
+bool BaseGlObject::drawObjectIndirect(unsigned int commandBuffer, unsigned int maxDraws, unsigned int parameterBuffer)
+{
+	PROFILE_CPU_ZONE("BaseGlObject::drawObjectIndirect");
+	if(!prepareDraw()) return false;
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	if(parameterBuffer) {
+		glBindBuffer(GL_PARAMETER_BUFFER, parameterBuffer);
+		// The core function only exists since 4.6
+		if(GLHelper::hasVersion(4, 6)) {
+			glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (void*) 0, 0, maxDraws, 0);
+		} else {
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, (void*) 0, 0, maxDraws, 0);
+		}
+		PROFILE_COUNT_BINDS(2);
+	} else {
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*) 0, maxDraws, 0);
+		PROFILE_COUNT_BINDS(1);
+	}
+	// The triangle count is only known on the GPU
+	PROFILE_COUNT_DRAW(0);
+	return true;
+}
+
+bool BaseGlObject::drawObjectRanges(const GLsizei* counts, const void* const* offsets, unsigned int drawCount)
+{
+	PROFILE_CPU_ZONE("BaseGlObject::drawObjectRanges");
+	if(!prepareDraw()) return false;
+	if(drawCount == 0) return true;
+	glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets, drawCount);
+#ifndef JG_DISABLE_PROFILER
+	uint64_t triangles = 0;
+	for(unsigned int i = 0; i < drawCount; i++)
+		triangles += counts[i] / 3;
+	PROFILE_COUNT_DRAW(triangles);
+#endif
+	return true;
+}
+
+bool BaseGlObject::drawPositionsOnly(const SimpleShaderInfo* shader)
+{
+	PROFILE_CPU_ZONE("BaseGlObject::drawPositionsOnly");
+	if(!preparePositionDraw(shader)) return false;
+	glDrawElements(GL_TRIANGLES, numberOfIndices, GL_UNSIGNED_INT, (void*) 0);
+	PROFILE_COUNT_DRAW(numberOfIndices / 3);
+	return true;
+}
+
+bool BaseGlObject::drawPositionsOnlyInstanced(const SimpleShaderInfo* shader)
+{
+	PROFILE_CPU_ZONE("BaseGlObject::drawPositionsOnlyInstanced");
+	if(!InstanceLayout.size()) return false;
+	if(!preparePositionDraw(shader)) return false;
+	uploadInstances();
+	if(numberOfInstances == 0) return true;
+	glDrawElementsInstanced(GL_TRIANGLES, numberOfIndices, GL_UNSIGNED_INT, (void*) 0, numberOfInstances);
+	PROFILE_COUNT_DRAW((uint64_t) (numberOfIndices / 3) * numberOfInstances);
+	return true;
+}
+
+unsigned int BaseGlObject::addInstanceF(const float* v)
+{
+	unsigned int num = numberOfInstances;
+	numberOfInstances++;
+	for(const AttributeLocation& A : InstanceLayout.getAttributes()) {
+		for(unsigned int i = 0; i < A.size; ++i) {
+			instanceData.push_back(*(v + A.offsetInStruct + i));
+		}
+	}
+	markInstancesDirty(num, numberOfInstances);
+	return num;
+}
+
+bool BaseGlObject::updateInstanceF(unsigned int index, const float* v)
+{
+	if(index >= numberOfInstances) return false;
+	float* dst = &instanceData[index * InstanceLayout.size()];
+	for(const AttributeLocation& A : InstanceLayout.getAttributes()) {
+		for(unsigned int i = 0; i < A.size; ++i) {
+			*(dst++) = *(v + A.offsetInStruct + i);
+		}
+	}
+	markInstancesDirty(index, index + 1);
+	return true;
+}
+
+bool BaseGlObject::removeInstance(unsigned int index)
+{
+	if(index >= numberOfInstances) return false;
+	unsigned int last = numberOfInstances - 1;
+	unsigned int s = InstanceLayout.size();
+	// Move the last instance into the gap, so only
+	// a single instance has to be uploaded again
+	if(index != last) {
+		std::copy(instanceData.begin() + last * s, instanceData.end(), instanceData.begin() + index * s);
+		markInstancesDirty(index, index + 1);
+	}
+	instanceData.resize(last * s);
+	numberOfInstances--;
+	return true;
+}
+
+void BaseGlObject::clearInstances()
+{
+	instanceData.clear();
+	numberOfInstances = 0;
+	dirtyInstancesBegin = dirtyInstancesEnd = 0;
+}
+
+void BaseGlObject::markInstancesDirty(unsigned int begin, unsigned int end)
+{
+	if(dirtyInstancesBegin == dirtyInstancesEnd) {
+		dirtyInstancesBegin = begin;
+		dirtyInstancesEnd = end;
+	} else {
+		dirtyInstancesBegin = std::min(dirtyInstancesBegin, begin);
+		dirtyInstancesEnd = std::max(dirtyInstancesEnd, end);
+	}
+}
+
+bool BaseGlObject::uploadInstances()
+{
+	if(graphicsCardStatus == 0) return false;
+	// Instances beyond the current count don't need uploading
+	dirtyInstancesEnd = std::min(dirtyInstancesEnd, numberOfInstances);
+	if(dirtyInstancesBegin >= dirtyInstancesEnd) {
+		dirtyInstancesBegin = dirtyInstancesEnd = 0;
+		return false;
+	}
+	unsigned int stride = sizeof(float) * InstanceLayout.size();
+	glBindBuffer(GL_ARRAY_BUFFER, ibo);
+	if(numberOfInstances > instanceCapacity) {
+		// Grow the buffer geometrically and upload everything,
+		// the vao keeps refering to the same buffer name
+		instanceCapacity = std::max(numberOfInstances, instanceCapacity * 2);
+		glBufferData(GL_ARRAY_BUFFER, stride * instanceCapacity, nullptr, GL_DYNAMIC_DRAW);
+		MemoryStats::resize(MemoryStats::Category::InstanceBuffer, gpuInstanceBytes, stride * instanceCapacity);
+		gpuInstanceBytes = stride * instanceCapacity;
+		glBufferSubData(GL_ARRAY_BUFFER, 0, stride * numberOfInstances, &instanceData[0]);
+		PROFILE_COUNT_UPLOAD(stride * numberOfInstances);
+	} else {
+		// Only upload the range that changed
+		glBufferSubData(
+			GL_ARRAY_BUFFER,
+			stride * dirtyInstancesBegin,
+			stride * (dirtyInstancesEnd - dirtyInstancesBegin),
+			&instanceData[dirtyInstancesBegin * InstanceLayout.size()]);
+		PROFILE_COUNT_UPLOAD(stride * (dirtyInstancesEnd - dirtyInstancesBegin));
+	}
+	PROFILE_COUNT_BINDS(1);
+	dirtyInstancesBegin = dirtyInstancesEnd = 0;
+	return true;
+}
+
 bool BaseGlObject::compareVertices(int64_t l, int64_t r)
 {
 	for(unsigned int i = 0; i < Layout.size(); ++i) {
@@ -310,13 +683,15 @@ bool BaseGlObject::disableVertexTracking()
 	if(!trackVertices) return false;
 	trackVertices = false;
 	vertexTracker.clear();
+	trackerResident = true;
 	return true;
 }
 
 bool BaseGlObject::enableVertexTracking(size_t start)
 {
 	if(trackVertices) return false;
-	trackVertices = false;
+	if(!cpuDataResident) ensureCpuData();
+	trackVertices = true;
 	for(size_t i = start; i < numberOfVertices; i++) {
 		vertexTracker.insert(std::pair<int64_t, size_t>((int64_t) i, i));
 	}
@@ -329,3 +704,100 @@ bool BaseGlObject::setEpsilon(float epsilon)
 	vertexEpsilon = epsilon;
 	return true;
 }
+
+void BaseGlObject::setResidency(MeshResidency R)
+{
+	residency = R;
+	if(graphicsCardStatus == 1) applyResidency();
+	updateMemoryStats();
+}
+
+void BaseGlObject::applyResidency()
+{
+	switch(residency) {
+		case MeshResidency::KeepAll:
+			return;
+		case MeshResidency::DropAll:
+			// Swap with empty vectors to really free the memory,
+			// an arena only gets it back when it is reset
+			std::pmr::vector<float>(vertexData.get_allocator()).swap(vertexData);
+			std::pmr::vector<unsigned int>(indexData.get_allocator()).swap(indexData);
+			cpuDataResident = false;
+			// The tracker is useless without the data
+			// Fall through
+		case MeshResidency::DropTracker:
+			if(trackVertices) {
+				vertexTracker.clear();
+				trackerResident = false;
+			}
+			return;
+	}
+}
+
+void BaseGlObject::ensureCpuData()
+{
+	if(!cpuDataResident && (graphicsCardStatus != 0)) {
+		PROFILE_CPU_ZONE("BaseGlObject::ensureCpuData");
+		// Read through the copy target so the vao stays untouched
+		vertexData.resize(numberOfVertices * Layout.size());
+		indexData.resize(numberOfIndices);
+		if(vertexData.size() && Layout.hasSeparateStream()) {
+			std::pmr::vector<float> interleaved(numberOfVertices * Layout.streamSize(AttributeLayout::STREAM_INTERLEAVED));
+			std::pmr::vector<float> separate(numberOfVertices * Layout.streamSize(AttributeLayout::STREAM_SEPARATE));
+			if(interleaved.size()) {
+				glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+				glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(float) * interleaved.size(), &interleaved[0]);
+			}
+			glBindBuffer(GL_COPY_READ_BUFFER, svbo);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(float) * separate.size(), &separate[0]);
+			Layout.mergeStreams(interleaved, separate, vertexData);
+		} else if(vertexData.size()) {
+			glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(float) * vertexData.size(), &vertexData[0]);
+		}
+		if(indexData.size()) {
+			glBindBuffer(GL_COPY_READ_BUFFER, eab);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(unsigned int) * indexData.size(), &indexData[0]);
+		}
+		cpuDataResident = true;
+	}
+	if(!trackerResident) {
+		if(trackVertices) {
+			for(size_t i = 0; i < numberOfVertices; i++) {
+				vertexTracker.insert(std::pair<int64_t, size_t>((int64_t) i, i));
+			}
+		}
+		trackerResident = true;
+	}
+	updateMemoryStats();
+}
+
+bool BaseGlObject::restoreCpuData()
+{
+	if(cpuDataResident && trackerResident) return false;
+	ensureCpuData();
+	return true;
+}
+
+int64_t BaseGlObject::cpuMemoryBytes() const
+{
+	return sizeof(float) * (vertexData.capacity() + instanceData.capacity()) +
+		   sizeof(unsigned int) * indexData.capacity() +
+		   trackerNodeBytes * vertexTracker.size();
+}
+
+void BaseGlObject::updateMemoryStats()
+{
+	int64_t v = sizeof(float) * vertexData.capacity();
+	int64_t i = sizeof(unsigned int) * indexData.capacity();
+	int64_t t = trackerNodeBytes * vertexTracker.size();
+	int64_t n = sizeof(float) * instanceData.capacity();
+	MemoryStats::resize(MemoryStats::Category::CpuVertices, accountedVertexBytes, v);
+	MemoryStats::resize(MemoryStats::Category::CpuIndices, accountedIndexBytes, i);
+	MemoryStats::resize(MemoryStats::Category::CpuTracker, accountedTrackerBytes, t);
+	MemoryStats::resize(MemoryStats::Category::CpuInstances, accountedInstanceBytes, n);
+	accountedVertexBytes = v;
+	accountedIndexBytes = i;
+	accountedTrackerBytes = t;
+	accountedInstanceBytes = n;
+}
@@ -3,69 +3,15 @@
 
 #include <functional>
 #include <map>
+#include <memory_resource>
 #include <vector>
 
-#include "../shaders/Shaders.h"
-
-// How to read an attribute from a struct
-// And how to map it to the OpenGL arrays
-// All sizes for floats
-struct AttributeLocation {
-	unsigned int size;
-	unsigned int offsetInStruct;
-	unsigned int offsetInGL;
-	const char* name;
-	AttributeLocation();
-	AttributeLocation(const AttributeLocation& ALoc);
-	AttributeLocation(const char* name_, unsigned int size_, unsigned int offset_);
-};
-
-// A shortcut for constructing an AttributeLocation
-// This will only need the name of the struct and name of
-// the struct memeber to get the size and offset of the
-// member in the struct.
-// The name of the attribute will be the same as the name
-// of the struct member.
-#define ATTRIB_LOC(STRUCT_NAME, MEMBER_NAME) AttributeLocation(#MEMBER_NAME,                                                  \
-															   sizeof(((STRUCT_NAME*) nullptr)->MEMBER_NAME) / sizeof(float), \
-															   offsetof(struct STRUCT_NAME, MEMBER_NAME) / sizeof(float))
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
-// Full description of all attributes for an object
-class AttributeLayout {
-  private:
-	std::vector<AttributeLocation> Attributes;
-	unsigned int totalSize;
-
-  public:
-	AttributeLayout();
-	AttributeLayout(const AttributeLocation& ALoc);
-	AttributeLayout(const AttributeLayout& ALay);
-	~AttributeLayout();
-	// Add an Attribute Location and increase the size
-	void append(const AttributeLocation& ALoc);
-	// Access to the size
-	inline unsigned int size() const { return totalSize; };
-	// Access to attributes
-	inline const std::vector<AttributeLocation> getAttributes() const { return Attributes; };
-};
-
-// Allow for an easy definition of an AttributeLayout by adding AttributeLocations
-// Add two AttributeLocations resulting in an AttributeLayout
-inline AttributeLayout operator+(const AttributeLocation& A, const AttributeLocation& B)
-{
-	AttributeLayout R(A);
-	R.append(B);
-	return R;
-}
-
-// Add an AtributeLocation to an AttributeLayout resulting in a AttributeLayout
-// This is needed when we are adding more then two AttributeLocations
-inline AttributeLayout operator+(const AttributeLayout& A, const AttributeLocation& B)
-{
-	AttributeLayout R(A);
-	R.append(B);
-	return R;
-}
+#include "../shaders/Shaders.h"
+#include "AttributeLayout.h"
+#include "MeshBuilder.h"
 
 struct IndexedTriangle {
 	unsigned int a;
@@ -77,9 +23,24 @@ struct IndexedTriangle {
 	IndexedTriangle operator+(unsigned int off) const;
 };
 
+// What stays in CPU memory after copying to the graphics card
+// KeepAll     - Vertices, indices and the vertex tracker
+// DropTracker - Vertices and indices, the tracker is rebuilt
+//               when more vertices are added
+// DropAll     - Nothing, the data is read back from the
+//               graphics card when it is modified again
+enum class MeshResidency {
+	KeepAll,
+	DropTracker,
+	DropAll
+};
+
 class BaseGlObject {
   private:
 	const AttributeLayout Layout;
+	// Layout of the per instance data, empty if
+	// the object is never drawn instanced
+	const AttributeLayout InstanceLayout;
 	// Could in theory be calculated from
 	// the data vectors but whatever.
 	// Might be useful if those are
@@ -91,8 +52,9 @@ class BaseGlObject {
 	// but std::list allocates way more memory
 	// per value for the linked list
 	// Instead we should have large blocks and link them
-	std::vector<float> vertexData;
-	std::vector<unsigned int> indexData;
+	// They come from the memory resource given to the constructor
+	std::pmr::vector<float> vertexData;
+	std::pmr::vector<unsigned int> indexData;
 	// Is the data on the graphics card and up to date
 	//  0 - No data on the graphics card
 	//  1 - Data on the graphics card and up to date
@@ -113,6 +75,22 @@ class BaseGlObject {
 	// Adapt the object to a newly set shader
 	// Or the current one if that one has changend
 	bool adaptToShader();
+	// Point the attributes of a layout to the bound array buffer
+	// A divisor of 1 advances the attributes once per instance
+	bool bindAttributes(const AttributeLayout& L, unsigned int divisor);
+	// Describe the attributes of a layout with glVertexAttribFormat and
+	// attach them to the binding points of their streams, used if the
+	// layout has a separate stream. With positionsOnly only the separate
+	// stream is used and attributes missing in the shader are skipped.
+	bool bindAttributeFormats(const AttributeLayout& L, unsigned int shader, bool instances, bool positionsOnly);
+	// Attach the buffers to the binding points of the bound vao
+	void bindVertexBuffers(bool positionsOnly);
+	// Binding points for the separate attribute format
+	static constexpr unsigned int BINDING_INSTANCES = 2;
+	// Adapt to the shader if needed and bind everything for drawing
+	bool prepareDraw();
+	// The same for the position only vao
+	bool preparePositionDraw(const SimpleShaderInfo* shader);
 	// Weird OpenGL Stuff
 	// Vertex Array Object
 	unsigned int vao;
@@ -120,9 +98,31 @@ class BaseGlObject {
 	unsigned int vbo;
 	// Element Array Buffer
 	unsigned int eab;
+	// Vertex buffer of the separate stream
+	unsigned int svbo;
+	// Vertex Array Object only reading the separate stream
+	// and the shader it was adapted to
+	unsigned int positionVao;
+	unsigned int lastPositionShader;
+	bool positionShaderCompatible;
+	// Instances, stored the same way as the vertices
+	unsigned int numberOfInstances;
+	std::pmr::vector<float> instanceData;
+	// Instance Buffer Object
+	unsigned int ibo;
+	// Number of instances the ibo has room for
+	unsigned int instanceCapacity;
+	// Range of instances changed since the last upload
+	unsigned int dirtyInstancesBegin;
+	unsigned int dirtyInstancesEnd;
+	void markInstancesDirty(unsigned int begin, unsigned int end);
+	// Upload changed instances, reallocating the ibo if it is too small
+	bool uploadInstances();
 	// With this the object will check if a vertex allready exists
 	bool trackVertices;
-	std::map<int64_t, size_t, std::function<bool(int64_t, int64_t)>> vertexTracker;
+	// Nodes come from their own resource, see MemoryArena::nodeResource
+	typedef std::map<int64_t, size_t, std::function<bool(int64_t, int64_t)>, std::pmr::polymorphic_allocator<std::pair<const int64_t, size_t>>> VertexTracker;
+	VertexTracker vertexTracker;
 	// Vertice comparison vertices at the indeced l and r
 	// according to vertex(l) < vertex(r)
 	// Where vertex(-1) refers to the buffer
@@ -131,9 +131,41 @@ class BaseGlObject {
 	float getCompVertexElement(int64_t i, unsigned int offset);
 	const float* newVertexPointer;
 	float vertexEpsilon;
+	// Bounding volumes of all vertices, only kept
+	// if the layout has a position attribute
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	// Center and radius
+	glm::vec4 boundingSphere;
+	// Grow the bounds to contain the vertex at this index
+	void expandBounds(unsigned int index);
+	void recomputeBounds();
+	// What is kept on the CPU after uploading
+	MeshResidency residency;
+	// Whether vertexData/indexData and the tracker are in memory
+	bool cpuDataResident;
+	bool trackerResident;
+	void applyResidency();
+	// Read dropped data back and refill the tracker if needed
+	void ensureCpuData();
+	// Bytes currently reported to MemoryStats
+	int64_t accountedVertexBytes;
+	int64_t accountedIndexBytes;
+	int64_t accountedTrackerBytes;
+	int64_t accountedInstanceBytes;
+	int64_t gpuVertexBytes;
+	int64_t gpuIndexBytes;
+	int64_t gpuInstanceBytes;
+	// Reorders the index data into meshlets
+	friend class MeshletSet;
 
   public:
-	BaseGlObject(const AttributeLayout& L);
+	// The vertex, index and instance data is allocated from memory and the
+	// tracker nodes from trackerMemory, which defaults to memory. Without a
+	// resource the default resource is used. Building the object in a
+	// MemoryArena saves most of the small allocations, but the arena
+	// can't be reset while the object exists.
+	BaseGlObject(const AttributeLayout& L, const AttributeLayout& I = AttributeLayout(), std::pmr::memory_resource* memory = nullptr, std::pmr::memory_resource* trackerMemory = nullptr);
 	~BaseGlObject();
 	// Add a vertex to the object and return its index
 	unsigned int addVertexF(const float* v);
@@ -162,6 +194,12 @@ class BaseGlObject {
 	{
 		addQuadrangleF((float*) &a, (float*) &b, (float*) &c, (float*) &d);
 	};
+	// Replace the vertices and indices with those of a builder
+	// The data is moved if the builder uses the same memory resource and
+	// copied otherwise, the builder is left empty
+	// Vertex tracking is disabled afterwards, enable it
+	// retroactively if more vertices should be welded
+	bool takeMesh(MeshBuilder&& M);
 	// Access to the number of verticies and indices
 	inline unsigned int sizeVertices() const { return numberOfVertices; };
 	inline unsigned int sizeIndeces() const { return numberOfIndices; };
@@ -173,6 +211,36 @@ class BaseGlObject {
 	bool setShader(const SimpleShaderInfo* shader);
 	// Draw the object
 	bool drawObject();
+	// Draw all instances with a single draw call
+	bool drawObjectInstanced();
+	// Draw ranges of the index data described by DrawElementsIndirectCommands
+	// in a buffer. If a parameter buffer is given the number of draws is read
+	// from it on the GPU and maxDraws is only an upper limit (GL 4.6 or
+	// ARB_indirect_parameters).
+	bool drawObjectIndirect(unsigned int commandBuffer, unsigned int maxDraws, unsigned int parameterBuffer = 0);
+	// Draw several ranges of the index data with a single glMultiDrawElements
+	// Counts are numbers of indices, offsets are in bytes
+	bool drawObjectRanges(const GLsizei* counts, const void* const* offsets, unsigned int drawCount);
+	// Draw with a shader that only reads the attributes of the separate
+	// stream (see AttributeLayout::setSeparateStream), e.g. for depth or
+	// shadow passes. Without a separate stream the interleaved buffer is
+	// read. Attributes the shader doesn't use are ignored. Needs GL 4.3.
+	bool drawPositionsOnly(const SimpleShaderInfo* shader);
+	bool drawPositionsOnlyInstanced(const SimpleShaderInfo* shader);
+	// Instances, only usable if an instance layout was given
+	// Add an instance and return its index
+	unsigned int addInstanceF(const float* v);
+	template <typename T>
+	inline unsigned int addInstance(const T& v) { return addInstanceF((float*) &v); };
+	// Overwrite an existing instance
+	bool updateInstanceF(unsigned int index, const float* v);
+	template <typename T>
+	inline bool updateInstance(unsigned int index, const T& v) { return updateInstanceF(index, (float*) &v); };
+	// Remove an instance, the last instance takes over its index
+	bool removeInstance(unsigned int index);
+	void clearInstances();
+	inline unsigned int sizeInstances() const { return numberOfInstances; };
+	inline bool hasInstanceAttributes() const { return InstanceLayout.size() > 0; };
 	// Enable/disable vertex tracking
 	// Disable and clear the map
 	bool disableVertexTracking();
@@ -182,6 +250,28 @@ class BaseGlObject {
 	inline bool enableVertexTrackingNow() { return enableVertexTracking(numberOfVertices); };
 	// Enable vertex tracking retroactively
 	inline bool enableVertexTrackingRetroactive() { return enableVertexTracking(0); };
+	// Bounding volumes, empty if there are no vertices
+	// or the layout has no position attribute
+	inline bool hasBounds() const { return Layout.hasPosition() && numberOfVertices; };
+	inline const glm::vec3& getBoundsMin() const { return boundsMin; };
+	inline const glm::vec3& getBoundsMax() const { return boundsMax; };
+	// The sphere is grown incrementally, so it contains
+	// every vertex but isn't necessarily the smallest one
+	inline const glm::vec4& getBoundingSphere() const { return boundingSphere; };
+	// Residency policy, applied whenever the data is copied to the graphics card
+	void setResidency(MeshResidency R);
+	inline MeshResidency getResidency() const { return residency; };
+	inline bool isCpuDataResident() const { return cpuDataResident; };
+	// Read dropped data back from the graphics card
+	// This waits for the graphics card
+	bool restoreCpuData();
+	// Memory used by the CPU mirrors, the tracker is an estimate
+	int64_t cpuMemoryBytes() const;
+	// Report the current size of the CPU mirrors to MemoryStats
+	// This happens automatically on upload, call it to
+	// account for data added since then
+	void updateMemoryStats();
+	inline std::pmr::memory_resource* getMemoryResource() const { return vertexData.get_allocator().resource(); };
 	// Access to the epsilon value
 	bool setEpsilon(float epsilon);
 	inline float getEpsilon() const { return vertexEpsilon; };
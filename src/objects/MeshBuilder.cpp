@@ -0,0 +1,346 @@
+#include "MeshBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+	// Run f(i) for all i < count on up to the given number of threads
+	template <typename F>
+	void parallelFor(unsigned int count, unsigned int threads, const F& f)
+	{
+		threads = std::max(1u, std::min(threads, count));
+		if(threads == 1) {
+			for(unsigned int i = 0; i < count; i++)
+				f(i);
+			return;
+		}
+		std::vector<std::thread> T;
+		for(unsigned int t = 0; t < threads; t++) {
+			T.emplace_back([&f, t, threads, count]() {
+				for(unsigned int i = t; i < count; i += threads)
+					f(i);
+			});
+		}
+		for(std::thread& t : T)
+			t.join();
+	}
+
+	std::pmr::memory_resource* orDefault(std::pmr::memory_resource* memory)
+	{
+		return memory ? memory : std::pmr::get_default_resource();
+	}
+} // namespace
+
+MeshBuilder::MeshBuilder(const AttributeLayout& L, std::pmr::memory_resource* memory, std::pmr::memory_resource* trackerMemory) :
+	Layout(L, orDefault(memory)),
+	numberOfVertices(0),
+	numberOfIndices(0),
+	vertexData(orDefault(memory)),
+	indexData(orDefault(memory)),
+	weldVertices(true),
+	vertexEpsilon(0.001f),
+	vertexTracker(0, VertexHash{this}, VertexEqual{this}, orDefault(trackerMemory)),
+	trackedVertices(0),
+	newVertexPointer(nullptr)
+{}
+
+MeshBuilder::MeshBuilder(const MeshBuilder& M) :
+	Layout(M.Layout, M.getMemoryResource()),
+	numberOfVertices(M.numberOfVertices),
+	numberOfIndices(M.numberOfIndices),
+	vertexData(M.vertexData, M.vertexData.get_allocator()),
+	indexData(M.indexData, M.indexData.get_allocator()),
+	weldVertices(M.weldVertices),
+	vertexEpsilon(M.vertexEpsilon),
+	vertexTracker(0, VertexHash{this}, VertexEqual{this}, M.vertexTracker.get_allocator()),
+	trackedVertices(0),
+	newVertexPointer(nullptr)
+{}
+
+MeshBuilder::MeshBuilder(MeshBuilder&& M) noexcept :
+	Layout(M.Layout, M.getMemoryResource()),
+	numberOfVertices(M.numberOfVertices),
+	numberOfIndices(M.numberOfIndices),
+	vertexData(std::move(M.vertexData)),
+	indexData(std::move(M.indexData)),
+	weldVertices(M.weldVertices),
+	vertexEpsilon(M.vertexEpsilon),
+	vertexTracker(0, VertexHash{this}, VertexEqual{this}, M.vertexTracker.get_allocator()),
+	trackedVertices(0),
+	newVertexPointer(nullptr)
+{
+	M.numberOfVertices = 0;
+	M.numberOfIndices = 0;
+	M.resetTracker();
+}
+
+int64_t MeshBuilder::quantize(float f) const
+{
+	if(vertexEpsilon > 0) {
+		return (int64_t) std::floor(f / vertexEpsilon);
+	}
+	// Without an epsilon only identical values are welded
+	// Treat 0 and -0 as the same value
+	if(f == 0) return 0;
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+size_t MeshBuilder::hashVertex(const float* v) const
+{
+	// FNV-1a over the snapped values
+	uint64_t h = 14695981039346656037ull;
+	for(unsigned int i = 0; i < Layout.size(); ++i) {
+		h ^= (uint64_t) quantize(v[i]);
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+bool MeshBuilder::equalVertices(const float* l, const float* r) const
+{
+	for(unsigned int i = 0; i < Layout.size(); ++i) {
+		if(quantize(l[i]) != quantize(r[i])) return false;
+	}
+	return true;
+}
+
+bool MeshBuilder::lessVertices(const float* l, const float* r) const
+{
+	for(unsigned int i = 0; i < Layout.size(); ++i) {
+		int64_t ql = quantize(l[i]);
+		int64_t qr = quantize(r[i]);
+		if(ql != qr) return ql < qr;
+	}
+	return false;
+}
+
+void MeshBuilder::resetTracker()
+{
+	vertexTracker.clear();
+	trackedVertices = weldVertices ? numberOfVertices : 0;
+	// Vertices added before welding was enabled are not welded
+	// against, so the tracker is considered to be up to date
+}
+
+unsigned int MeshBuilder::addVertexF(const float* v)
+{
+	if(weldVertices) {
+		// Catch up on vertices that were added without the tracker
+		for(; trackedVertices < numberOfVertices; trackedVertices++) {
+			vertexTracker.emplace(trackedVertices, trackedVertices);
+		}
+		newVertexPointer = v;
+		auto found = vertexTracker.find(-1);
+		newVertexPointer = nullptr;
+		if(found != vertexTracker.end()) return found->second;
+	}
+	unsigned int num = numberOfVertices;
+	numberOfVertices++;
+	for(const AttributeLocation& A : Layout.getAttributes()) {
+		for(unsigned int i = 0; i < A.size; ++i) {
+			vertexData.push_back(*(v + A.offsetInStruct + i));
+		}
+	}
+	if(weldVertices) {
+		vertexTracker.emplace(num, num);
+		trackedVertices = numberOfVertices;
+	}
+	return num;
+}
+
+void MeshBuilder::connectTriangle(
+	unsigned int indexA,
+	unsigned int indexB,
+	unsigned int indexC)
+{
+	indexData.push_back(indexA);
+	indexData.push_back(indexB);
+	indexData.push_back(indexC);
+	numberOfIndices += 3;
+}
+
+void MeshBuilder::addTriangleF(
+	const float* a,
+	const float* b,
+	const float* c)
+{
+	unsigned int va = addVertexF(a);
+	unsigned int vb = addVertexF(b);
+	unsigned int vc = addVertexF(c);
+	connectTriangle(va, vb, vc);
+}
+
+void MeshBuilder::connectQuadrangle(
+	unsigned int indexA,
+	unsigned int indexB,
+	unsigned int indexC,
+	unsigned int indexD)
+{
+	connectTriangle(indexA, indexB, indexC);
+	connectTriangle(indexA, indexC, indexD);
+}
+
+void MeshBuilder::addQuadrangleF(
+	const float* a,
+	const float* b,
+	const float* c,
+	const float* d)
+{
+	unsigned int va = addVertexF(a);
+	unsigned int vb = addVertexF(b);
+	unsigned int vc = addVertexF(c);
+	unsigned int vd = addVertexF(d);
+	connectTriangle(va, vb, vc);
+	connectTriangle(va, vc, vd);
+}
+
+void MeshBuilder::reserve(unsigned int vertices, unsigned int indices)
+{
+	vertexData.reserve((size_t) vertices * Layout.size());
+	indexData.reserve(indices);
+	if(weldVertices) vertexTracker.reserve(vertices);
+}
+
+void MeshBuilder::setWelding(bool weld)
+{
+	weldVertices = weld;
+	resetTracker();
+}
+
+bool MeshBuilder::setEpsilon(float epsilon)
+{
+	if(epsilon < 0) return false;
+	vertexEpsilon = epsilon;
+	resetTracker();
+	return true;
+}
+
+MeshBuilder MeshBuilder::merge(std::vector<MeshBuilder>& builders, unsigned int threads, std::pmr::memory_resource* memory)
+{
+	if(builders.empty()) {
+		throw std::invalid_argument("Can't merge an empty list of mesh builders\n");
+	}
+	const MeshBuilder& first = builders[0];
+	const unsigned int s = first.Layout.size();
+	for(const MeshBuilder& B : builders) {
+		if((B.Layout.size() != s) || (B.vertexEpsilon != first.vertexEpsilon)) {
+			throw std::invalid_argument("Can't merge mesh builders with different layouts or epsilons\n");
+		}
+	}
+	if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	const unsigned int n = builders.size();
+	// Where each builder starts in the combined vertex and index lists
+	std::vector<unsigned int> vertexOffset(n + 1, 0);
+	std::vector<unsigned int> indexOffset(n + 1, 0);
+	for(unsigned int b = 0; b < n; b++) {
+		vertexOffset[b + 1] = vertexOffset[b] + builders[b].numberOfVertices;
+		indexOffset[b + 1] = indexOffset[b] + builders[b].numberOfIndices;
+	}
+	const unsigned int totalVertices = vertexOffset[n];
+	auto vertex = [&](unsigned int g) -> const float* {
+		unsigned int b = std::upper_bound(vertexOffset.begin(), vertexOffset.end(), g) - vertexOffset.begin() - 1;
+		return &builders[b].vertexData[(size_t) (g - vertexOffset[b]) * s];
+	};
+	// For every vertex the vertex it is welded to, initially itself
+	std::vector<unsigned int> representative(totalVertices);
+	for(unsigned int g = 0; g < totalVertices; g++)
+		representative[g] = g;
+	if(first.weldVertices) {
+		// Partition the vertices by hash once. Every thread hashes a
+		// contiguous range and counts its vertices per bucket, then
+		// scatters them, so each bucket lists its vertices in order.
+		const unsigned int buckets = threads;
+		std::vector<uint64_t> hashes(totalVertices);
+		std::vector<unsigned int> rangeCount((size_t) threads * buckets, 0);
+		auto range = [&](unsigned int t) { return (unsigned int) ((uint64_t) totalVertices * t / threads); };
+		parallelFor(threads, threads, [&](unsigned int t) {
+			for(unsigned int g = range(t); g < range(t + 1); g++) {
+				hashes[g] = first.hashVertex(vertex(g));
+				rangeCount[(size_t) t * buckets + hashes[g] % buckets]++;
+			}
+		});
+		// Where every range writes into every bucket
+		std::vector<unsigned int> bucketStart(buckets + 1, 0);
+		std::vector<unsigned int> rangeOffset((size_t) threads * buckets);
+		unsigned int sum = 0;
+		for(unsigned int k = 0; k < buckets; k++) {
+			bucketStart[k] = sum;
+			for(unsigned int t = 0; t < threads; t++) {
+				rangeOffset[(size_t) t * buckets + k] = sum;
+				sum += rangeCount[(size_t) t * buckets + k];
+			}
+		}
+		bucketStart[buckets] = sum;
+		std::vector<unsigned int> bucketed(totalVertices);
+		parallelFor(threads, threads, [&](unsigned int t) {
+			for(unsigned int g = range(t); g < range(t + 1); g++)
+				bucketed[rangeOffset[(size_t) t * buckets + hashes[g] % buckets]++] = g;
+		});
+		// Weld the buckets in parallel, sorting them so equal vertices end
+		// up next to each other and the one with the lowest index comes first
+		parallelFor(buckets, threads, [&](unsigned int k) {
+			std::sort(bucketed.begin() + bucketStart[k], bucketed.begin() + bucketStart[k + 1], [&](unsigned int l, unsigned int r) {
+				if(hashes[l] != hashes[r]) return hashes[l] < hashes[r];
+				const float* vl = vertex(l);
+				const float* vr = vertex(r);
+				if(first.lessVertices(vl, vr)) return true;
+				if(first.lessVertices(vr, vl)) return false;
+				return l < r;
+			});
+			for(unsigned int i = bucketStart[k] + 1; i < bucketStart[k + 1]; i++) {
+				unsigned int prev = representative[bucketed[i - 1]];
+				if((hashes[bucketed[i]] == hashes[prev]) && first.equalVertices(vertex(bucketed[i]), vertex(prev))) {
+					representative[bucketed[i]] = prev;
+				}
+			}
+		});
+	}
+	// Count the surviving vertices per builder to find where they go
+	std::vector<unsigned int> survivorOffset(n + 1, 0);
+	parallelFor(n, threads, [&](unsigned int b) {
+		for(unsigned int g = vertexOffset[b]; g < vertexOffset[b + 1]; g++) {
+			if(representative[g] == g) survivorOffset[b + 1]++;
+		}
+	});
+	for(unsigned int b = 0; b < n; b++)
+		survivorOffset[b + 1] += survivorOffset[b];
+	MeshBuilder R(first.Layout, memory ? memory : first.getMemoryResource(), first.vertexTracker.get_allocator().resource());
+	R.weldVertices = first.weldVertices;
+	R.vertexEpsilon = first.vertexEpsilon;
+	R.numberOfVertices = survivorOffset[n];
+	R.numberOfIndices = indexOffset[n];
+	R.vertexData.resize((size_t) R.numberOfVertices * s);
+	R.indexData.resize(R.numberOfIndices);
+	// Copy the surviving vertices and remember where they went
+	std::vector<unsigned int> newIndex(totalVertices);
+	parallelFor(n, threads, [&](unsigned int b) {
+		unsigned int next = survivorOffset[b];
+		for(unsigned int g = vertexOffset[b]; g < vertexOffset[b + 1]; g++) {
+			if(representative[g] != g) continue;
+			newIndex[g] = next;
+			memcpy(&R.vertexData[(size_t) next * s], vertex(g), sizeof(float) * s);
+			next++;
+		}
+	});
+	// Remap the indices
+	parallelFor(n, threads, [&](unsigned int b) {
+		const MeshBuilder& B = builders[b];
+		for(unsigned int i = 0; i < B.numberOfIndices; i++) {
+			R.indexData[indexOffset[b] + i] = newIndex[representative[vertexOffset[b] + B.indexData[i]]];
+		}
+	});
+	// The merged builders are used up
+	for(MeshBuilder& B : builders) {
+		B.vertexData.clear();
+		B.indexData.clear();
+		B.numberOfVertices = 0;
+		B.numberOfIndices = 0;
+		B.resetTracker();
+	}
+	return R;
+}
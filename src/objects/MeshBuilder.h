@@ -0,0 +1,120 @@
+#ifndef MESH_BUILDER_H_DEFINED
+#define MESH_BUILDER_H_DEFINED
+
+#include <cstdint>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "AttributeLayout.h"
+
+// Builds the same vertex and index data as a BaseGlObject
+// but without touching OpenGL, so it can be filled on any thread.
+// Use one builder per thread, merge them with MeshBuilder::merge
+// and hand the result to BaseGlObject::takeMesh on the GL thread.
+//
+// Unlike the BaseGlObject tracker, welding snaps every attribute
+// to a grid with a cell size of epsilon and treats vertices in
+// the same cell as equal. This is an equivalence relation, which
+// allows hashing and welding the builders in parallel.
+//
+// Give every thread its own MemoryArena, builders filled from it don't
+// touch the global heap for every vertex and tracker node.
+class MeshBuilder {
+  private:
+	AttributeLayout Layout;
+	unsigned int numberOfVertices;
+	unsigned int numberOfIndices;
+	std::pmr::vector<float> vertexData;
+	std::pmr::vector<unsigned int> indexData;
+	// Welding
+	bool weldVertices;
+	float vertexEpsilon;
+	// Hash and compare vertices by their index, where
+	// -1 refers to the vertex that is currently added
+	struct VertexHash {
+		const MeshBuilder* builder;
+		size_t operator()(int64_t i) const { return builder->hashVertex(builder->getVertex(i)); };
+	};
+	struct VertexEqual {
+		const MeshBuilder* builder;
+		bool operator()(int64_t l, int64_t r) const { return builder->equalVertices(builder->getVertex(l), builder->getVertex(r)); };
+	};
+	std::pmr::unordered_map<int64_t, unsigned int, VertexHash, VertexEqual> vertexTracker;
+	// Vertices before this one are in the tracker, the tracker
+	// is filled lazily so merged builders don't pay for it
+	unsigned int trackedVertices;
+	const float* newVertexPointer;
+	inline const float* getVertex(int64_t i) const
+	{
+		return (i == -1) ? newVertexPointer : &vertexData[i * Layout.size()];
+	};
+	// Snap a single value to the welding grid
+	int64_t quantize(float f) const;
+	size_t hashVertex(const float* v) const;
+	bool equalVertices(const float* l, const float* r) const;
+	// Order of the snapped values, only used while merging
+	bool lessVertices(const float* l, const float* r) const;
+	void resetTracker();
+
+	friend class BaseGlObject;
+
+  public:
+	// Vertices and indices come from memory, the tracker from
+	// trackerMemory, both default to the default resource
+	MeshBuilder(const AttributeLayout& L, std::pmr::memory_resource* memory = nullptr, std::pmr::memory_resource* trackerMemory = nullptr);
+	// Copies use the resources of the original
+	MeshBuilder(const MeshBuilder& M);
+	// noexcept so growing a vector of builders moves them instead of
+	// copying their data, only copying the layout can run out of memory
+	MeshBuilder(MeshBuilder&& M) noexcept;
+	~MeshBuilder() = default;
+	// The tracker refers to its owner, so it can't simply be assigned
+	MeshBuilder& operator=(const MeshBuilder& M) = delete;
+	MeshBuilder& operator=(MeshBuilder&& M) = delete;
+	// Add a vertex read from a struct in the layout and return its index
+	unsigned int addVertexF(const float* v);
+	template <typename T>
+	inline unsigned int addVertex(const T& v) { return addVertexF((float*) &v); };
+	// Add a triangle
+	// By the indeces
+	void connectTriangle(unsigned int indexA, unsigned int indexB, unsigned int indexC);
+	// By the vertex data
+	void addTriangleF(const float* a, const float* b, const float* c);
+	template <typename T>
+	inline void addTriangle(const T& a, const T& b, const T& c)
+	{
+		addTriangleF((float*) &a, (float*) &b, (float*) &c);
+	};
+	// Add a quadrangle by adding two triangles
+	// both sharing the side AC
+	void connectQuadrangle(unsigned int indexA, unsigned int indexB, unsigned int indexC, unsigned int indexD);
+	void addQuadrangleF(const float* a, const float* b, const float* c, const float* d);
+	template <typename T>
+	inline void addQuadrangle(const T& a, const T& b, const T& c, const T& d)
+	{
+		addQuadrangleF((float*) &a, (float*) &b, (float*) &c, (float*) &d);
+	};
+	// Reserve memory up front
+	void reserve(unsigned int vertices, unsigned int indices);
+	// Access to the number of verticies and indices
+	inline unsigned int sizeVertices() const { return numberOfVertices; };
+	inline unsigned int sizeIndeces() const { return numberOfIndices; };
+	inline const AttributeLayout& getLayout() const { return Layout; };
+	inline std::pmr::memory_resource* getMemoryResource() const { return vertexData.get_allocator().resource(); };
+	// Welding, enabled by default
+	// Changing either of these clears the welding state,
+	// only vertices added afterwards will be welded
+	void setWelding(bool weld);
+	inline bool isWelding() const { return weldVertices; };
+	bool setEpsilon(float epsilon);
+	inline float getEpsilon() const { return vertexEpsilon; };
+	// Merge builders into one, using up to the given number of threads
+	// If the first builder welds, vertices shared between builders are
+	// welded as well. All builders need the same layout and epsilon.
+	// The builders are left empty. The result uses the resources of the
+	// first builder unless memory is given.
+	static MeshBuilder merge(std::vector<MeshBuilder>& builders, unsigned int threads = 0, std::pmr::memory_resource* memory = nullptr);
+};
+
+#endif
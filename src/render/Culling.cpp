@@ -0,0 +1,232 @@
+#include "Culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define CULLING_USE_SSE
+#endif
+
+using namespace Culling;
+
+namespace {
+	// Row i of a column major matrix
+	glm::vec4 row(const glm::mat4& M, int i)
+	{
+		return glm::vec4(M[0][i], M[1][i], M[2][i], M[3][i]);
+	}
+
+	float planeDistance(const glm::vec4& p, float x, float y, float z)
+	{
+		return p.x * x + p.y * y + p.z * z + p.w;
+	}
+} // namespace
+
+Frustum Culling::extractFrustum(const glm::mat4& viewProjection)
+{
+	// Gribb and Hartmann, every plane is the sum or
+	// difference of the last row and one of the others
+	Frustum F;
+	glm::vec4 r0 = row(viewProjection, 0);
+	glm::vec4 r1 = row(viewProjection, 1);
+	glm::vec4 r2 = row(viewProjection, 2);
+	glm::vec4 r3 = row(viewProjection, 3);
+	F.planes[0] = r3 + r0; // Left
+	F.planes[1] = r3 - r0; // Right
+	F.planes[2] = r3 + r1; // Bottom
+	F.planes[3] = r3 - r1; // Top
+	F.planes[4] = r3 + r2; // Near
+	F.planes[5] = r3 - r2; // Far
+	for(glm::vec4& p : F.planes) {
+		float l = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+		if(l > 0) {
+			p.x /= l;
+			p.y /= l;
+			p.z /= l;
+			p.w /= l;
+		}
+	}
+	return F;
+}
+
+Frustum Culling::extractFrustum(const UBOTransforms& T)
+{
+	return extractFrustum(T.perspective * T.toWorldSpace);
+}
+
+bool Culling::sphereVisible(const Frustum& F, const glm::vec4& sphere)
+{
+	for(const glm::vec4& p : F.planes) {
+		if(planeDistance(p, sphere.x, sphere.y, sphere.z) < -sphere.w) return false;
+	}
+	return true;
+}
+
+Result Culling::classifyAABB(const Frustum& F, const glm::vec3& min, const glm::vec3& max)
+{
+	Result R = Result::Inside;
+	for(const glm::vec4& p : F.planes) {
+		// The corners furthest along and against the normal
+		float px = (p.x >= 0) ? max.x : min.x;
+		float py = (p.y >= 0) ? max.y : min.y;
+		float pz = (p.z >= 0) ? max.z : min.z;
+		if(planeDistance(p, px, py, pz) < 0) return Result::Outside;
+		float nx = (p.x >= 0) ? min.x : max.x;
+		float ny = (p.y >= 0) ? min.y : max.y;
+		float nz = (p.z >= 0) ? min.z : max.z;
+		if(planeDistance(p, nx, ny, nz) < 0) R = Result::Intersecting;
+	}
+	return R;
+}
+
+unsigned int SphereSet::add(const glm::vec4& sphere)
+{
+	x.push_back(sphere.x);
+	y.push_back(sphere.y);
+	z.push_back(sphere.z);
+	r.push_back(sphere.w);
+	return r.size() - 1;
+}
+
+void SphereSet::set(unsigned int index, const glm::vec4& sphere)
+{
+	x[index] = sphere.x;
+	y[index] = sphere.y;
+	z[index] = sphere.z;
+	r[index] = sphere.w;
+}
+
+void SphereSet::clear()
+{
+	x.clear();
+	y.clear();
+	z.clear();
+	r.clear();
+}
+
+void SphereSet::reserve(size_t count)
+{
+	x.reserve(count);
+	y.reserve(count);
+	z.reserve(count);
+	r.reserve(count);
+}
+
+size_t Culling::cullSpheres(const Frustum& F, const SphereSet& S, std::vector<unsigned int>& visible)
+{
+	size_t before = visible.size();
+	size_t n = S.size();
+	size_t i = 0;
+#ifdef CULLING_USE_SSE
+	// Four spheres at a time
+	__m128 px[6], py[6], pz[6], pw[6];
+	for(int p = 0; p < 6; p++) {
+		px[p] = _mm_set1_ps(F.planes[p].x);
+		py[p] = _mm_set1_ps(F.planes[p].y);
+		pz[p] = _mm_set1_ps(F.planes[p].z);
+		pw[p] = _mm_set1_ps(F.planes[p].w);
+	}
+	const __m128 zero = _mm_setzero_ps();
+	for(; i + 4 <= n; i += 4) {
+		__m128 x = _mm_loadu_ps(&S.x[i]);
+		__m128 y = _mm_loadu_ps(&S.y[i]);
+		__m128 z = _mm_loadu_ps(&S.z[i]);
+		__m128 negR = _mm_sub_ps(zero, _mm_loadu_ps(&S.r[i]));
+		__m128 outside = zero;
+		for(int p = 0; p < 6; p++) {
+			__m128 d = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(px[p], x), _mm_mul_ps(py[p], y)),
+				_mm_add_ps(_mm_mul_ps(pz[p], z), pw[p]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negR));
+		}
+		int mask = ~_mm_movemask_ps(outside) & 0xf;
+		while(mask) {
+			int bit = __builtin_ctz(mask);
+			visible.push_back(i + bit);
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for(; i < n; i++) {
+		if(sphereVisible(F, glm::vec4(S.x[i], S.y[i], S.z[i], S.r[i]))) visible.push_back(i);
+	}
+	return visible.size() - before;
+}
+
+void BVH::build(const std::vector<glm::vec4>& spheres_)
+{
+	spheres = spheres_;
+	items.resize(spheres.size());
+	for(unsigned int i = 0; i < items.size(); i++)
+		items[i] = i;
+	nodes.clear();
+	if(spheres.size()) {
+		nodes.reserve(2 * (spheres.size() / LEAF_SIZE + 1));
+		build(0, spheres.size());
+	}
+}
+
+unsigned int BVH::build(unsigned int first, unsigned int count)
+{
+	unsigned int index = nodes.size();
+	nodes.push_back(Node());
+	// Bounds of all spheres in the range
+	glm::vec3 min(INFINITY);
+	glm::vec3 max(-INFINITY);
+	for(unsigned int i = first; i < first + count; i++) {
+		const glm::vec4& s = spheres[items[i]];
+		for(int a = 0; a < 3; a++) {
+			min[a] = std::min(min[a], s[a] - s.w);
+			max[a] = std::max(max[a], s[a] + s.w);
+		}
+	}
+	unsigned int right = 0;
+	if(count > LEAF_SIZE) {
+		// Split at the median along the longest axis
+		int axis = 0;
+		for(int a = 1; a < 3; a++) {
+			if(max[a] - min[a] > max[axis] - min[axis]) axis = a;
+		}
+		unsigned int half = count / 2;
+		std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+						 [&](unsigned int l, unsigned int r) { return spheres[l][axis] < spheres[r][axis]; });
+		build(first, half);
+		right = build(first + half, count - half);
+	}
+	Node& N = nodes[index];
+	N.min = min;
+	N.max = max;
+	N.first = first;
+	N.count = count;
+	N.right = right;
+	return index;
+}
+
+size_t BVH::query(const Frustum& F, std::vector<unsigned int>& visible) const
+{
+	size_t before = visible.size();
+	if(nodes.empty()) return 0;
+	unsigned int stack[64];
+	unsigned int top = 0;
+	stack[top++] = 0;
+	while(top) {
+		const Node& N = nodes[stack[--top]];
+		Result R = classifyAABB(F, N.min, N.max);
+		if(R == Result::Outside) continue;
+		if(R == Result::Inside) {
+			// Everything below is visible
+			visible.insert(visible.end(), items.begin() + N.first, items.begin() + N.first + N.count);
+			continue;
+		}
+		if(N.right == 0) {
+			for(unsigned int i = N.first; i < N.first + N.count; i++) {
+				if(sphereVisible(F, spheres[items[i]])) visible.push_back(items[i]);
+			}
+			continue;
+		}
+		stack[top++] = N.right;
+		stack[top++] = &N - &nodes[0] + 1;
+	}
+	return visible.size() - before;
+}
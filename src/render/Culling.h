@@ -0,0 +1,90 @@
+#ifndef CULLING_H_DEFINED
+#define CULLING_H_DEFINED
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../buffers/UniformBufferObjects.h"
+
+// Frustum culling of bounding spheres
+// Spheres are stored as structure of arrays so four of them can be
+// tested against a plane with a single SSE instruction.
+namespace Culling {
+	// Planes as (normal, distance), normals point inwards
+	struct Frustum {
+		glm::vec4 planes[6];
+	};
+
+	// Extract the planes from a combined projection and view matrix
+	Frustum extractFrustum(const glm::mat4& viewProjection);
+	// Use the matrices the shaders use, perspective * toWorldSpace
+	Frustum extractFrustum(const UBOTransforms& T);
+
+	// Test a single sphere given as (center, radius)
+	bool sphereVisible(const Frustum& F, const glm::vec4& sphere);
+
+	enum class Result {
+		Outside,
+		Intersecting,
+		Inside
+	};
+	Result classifyAABB(const Frustum& F, const glm::vec3& min, const glm::vec3& max);
+
+	// Bounding spheres as structure of arrays
+	class SphereSet {
+	  private:
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> z;
+		std::vector<float> r;
+		friend size_t cullSpheres(const Frustum& F, const SphereSet& S, std::vector<unsigned int>& visible);
+
+	  public:
+		SphereSet() = default;
+		// Add a sphere and return its index
+		unsigned int add(const glm::vec4& sphere);
+		void set(unsigned int index, const glm::vec4& sphere);
+		void clear();
+		void reserve(size_t count);
+		inline size_t size() const { return r.size(); };
+	};
+
+	// Append the indices of all visible spheres to visible
+	// and return how many there were
+	size_t cullSpheres(const Frustum& F, const SphereSet& S, std::vector<unsigned int>& visible);
+
+	// Bounding volume hierarchy over spheres that don't move
+	// Whole subtrees outside or inside the frustum are resolved
+	// with a single test, so large scenes scale sub-linearly
+	class BVH {
+	  private:
+		struct Node {
+			glm::vec3 min;
+			glm::vec3 max;
+			// Range of items below this node
+			unsigned int first;
+			unsigned int count;
+			// Index of the right child, the left child directly
+			// follows its parent, 0 for leaves
+			unsigned int right;
+		};
+		std::vector<Node> nodes;
+		// Sphere indices sorted so each node covers a range
+		std::vector<unsigned int> items;
+		std::vector<glm::vec4> spheres;
+		unsigned int build(unsigned int first, unsigned int count);
+
+	  public:
+		// Maximum number of spheres in a leaf
+		static constexpr unsigned int LEAF_SIZE = 4;
+		BVH() = default;
+		// Build the tree, query results are indices into this vector
+		void build(const std::vector<glm::vec4>& spheres_);
+		// Append the indices of all visible spheres and return how many there were
+		size_t query(const Frustum& F, std::vector<unsigned int>& visible) const;
+		inline size_t size() const { return spheres.size(); };
+	};
+}; // namespace Culling
+
+#endif
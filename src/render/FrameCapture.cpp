@@ -0,0 +1,208 @@
+#include "FrameCapture.h"
+
+#include <algorithm>
+
+#include "../util/GLHelper.h"
+#include "../util/ImageWriter.h"
+#include "../util/MemoryStats.h"
+#include "../util/Profiler.h"
+
+FrameCapture::FrameCapture(unsigned int workerCount, unsigned int ringSize) :
+	slots(std::max(2u, ringSize)),
+	nextSlot(0),
+	oldestPending(0),
+	frameIndex(0),
+	output(Output::PNG),
+	pattern("frame_%06llu.png"),
+	busyWorkers(0),
+	stopping(false),
+	captured(0),
+	dropped(0),
+	delivered(0)
+{
+	for(unsigned int i = 0; i < std::max(1u, workerCount); i++) {
+		workers.push_back(std::thread(&FrameCapture::work, this));
+	}
+}
+
+FrameCapture::~FrameCapture()
+{
+	finish();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobsChanged.notify_all();
+	for(std::thread& T : workers)
+		T.join();
+	// Needs the context to still be current
+	for(Slot& S : slots) {
+		if(!S.pbo) continue;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, S.pbo);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glDeleteBuffers(1, &S.pbo);
+		MemoryStats::release(MemoryStats::Category::PixelBuffer, S.capacity);
+	}
+}
+
+void FrameCapture::setOutput(Output O, const std::string& pattern_)
+{
+	// The workers read these without locking
+	finish();
+	output = O;
+	if(pattern_ != "") pattern = pattern_;
+}
+
+void FrameCapture::setCallback(Callback C)
+{
+	finish();
+	callback = C;
+	output = Output::Callback;
+}
+
+bool FrameCapture::resizeSlot(Slot& S, size_t bytes)
+{
+	if(S.pbo) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, S.pbo);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glDeleteBuffers(1, &S.pbo);
+		MemoryStats::release(MemoryStats::Category::PixelBuffer, S.capacity);
+		S.pbo = 0;
+		S.mapped = nullptr;
+		S.capacity = 0;
+	}
+	// Coherent, so the data is visible as soon as the fence is signaled
+	const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &S.pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, S.pbo);
+	glBufferStorage(GL_PIXEL_PACK_BUFFER, bytes, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+	S.mapped = (const unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, flags);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if(S.mapped == nullptr) {
+		printf("Error: Can't map a pixel buffer for frame capture\n");
+		glDeleteBuffers(1, &S.pbo);
+		S.pbo = 0;
+		return false;
+	}
+	S.capacity = bytes;
+	MemoryStats::allocate(MemoryStats::Category::PixelBuffer, bytes);
+	return true;
+}
+
+bool FrameCapture::capture(int x, int y, unsigned int width, unsigned int height)
+{
+	PROFILE_CPU_ZONE("FrameCapture::capture");
+	uint64_t index = frameIndex++;
+	collect(false);
+	Slot& S = slots[nextSlot];
+	size_t bytes = (size_t) width * height * 4;
+	// Never wait, a full ring means the frame is lost
+	if((S.state != SlotState::Free) || ((bytes > S.capacity) && !resizeSlot(S, bytes))) {
+		dropped++;
+		return false;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, S.pbo);
+	glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*) 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	S.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	S.width = width;
+	S.height = height;
+	S.index = index;
+	S.state = SlotState::Pending;
+	nextSlot = (nextSlot + 1) % slots.size();
+	captured++;
+	return true;
+}
+
+void FrameCapture::update()
+{
+	PROFILE_CPU_ZONE("FrameCapture::update");
+	collect(false);
+}
+
+void FrameCapture::collect(bool wait)
+{
+	// Fences are signaled in the order the captures were made
+	while(slots[oldestPending].state == SlotState::Pending) {
+		Slot& S = slots[oldestPending];
+		GLenum result = glClientWaitSync(S.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000ull : 0);
+		if(result == GL_TIMEOUT_EXPIRED) {
+			if(wait) continue;
+			return;
+		}
+		if(result == GL_WAIT_FAILED) printf("Error: Waiting for a frame capture failed\n");
+		glDeleteSync(S.fence);
+		S.fence = nullptr;
+		S.state = SlotState::Reading;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(oldestPending);
+		}
+		jobsChanged.notify_one();
+		oldestPending = (oldestPending + 1) % slots.size();
+	}
+}
+
+void FrameCapture::finish()
+{
+	collect(true);
+	std::unique_lock<std::mutex> lock(mutex);
+	slotsChanged.wait(lock, [this]() { return jobs.empty() && (busyWorkers == 0); });
+}
+
+void FrameCapture::work()
+{
+	while(true) {
+		unsigned int s;
+		CapturedFrame F;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobsChanged.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if(jobs.empty()) return;
+			s = jobs.front();
+			jobs.pop_front();
+			busyWorkers++;
+			if(!pixelPool.empty()) {
+				F.pixels.swap(pixelPool.back());
+				pixelPool.pop_back();
+			}
+		}
+		Slot& S = slots[s];
+		F.width = S.width;
+		F.height = S.height;
+		F.index = S.index;
+		F.pixels.resize((size_t) F.width * F.height * 4);
+		{
+			PROFILE_CPU_ZONE("FrameCapture::copy");
+			// OpenGL stores the rows from bottom to top
+			GLHelper::copyImageFlippedY(S.mapped, F.pixels.data(), F.width, F.height);
+		}
+		// The buffer can take the next capture while we encode
+		S.state = SlotState::Free;
+		deliver(F);
+		delivered++;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busyWorkers--;
+			if(F.pixels.capacity()) pixelPool.push_back(std::move(F.pixels));
+		}
+		slotsChanged.notify_all();
+	}
+}
+
+void FrameCapture::deliver(CapturedFrame& F)
+{
+	PROFILE_CPU_ZONE("FrameCapture::deliver");
+	if(output == Output::Callback) {
+		if(callback) callback(F);
+		return;
+	}
+	char name[512];
+	snprintf(name, sizeof(name), pattern.c_str(), (unsigned long long) F.index);
+	if(output == Output::PNG) {
+		ImageWriter::writePNG(name, F.pixels.data(), F.width, F.height);
+	} else {
+		ImageWriter::writeRaw(name, F.pixels.data(), F.width, F.height);
+	}
+}
@@ -0,0 +1,120 @@
+#ifndef FRAME_CAPTURE_H_DEFINED
+#define FRAME_CAPTURE_H_DEFINED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GLInclude.h>
+
+// Captured image, RGBA with rows from top to bottom
+struct CapturedFrame {
+	std::vector<unsigned char> pixels;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	// Counts calls to capture(), dropped frames leave gaps
+	uint64_t index = 0;
+};
+
+// Asynchronous readback of the framebuffer
+// capture() only queues a glReadPixels into a pixel pack buffer and a
+// fence, so it never waits for the graphics card. update() checks the
+// fences of earlier captures and hands finished ones to worker threads,
+// which copy the pixels out of the persistently mapped buffer, flip them
+// and write them to a file or pass them to a callback.
+// If every buffer of the ring is still in use the frame is dropped
+// instead of stalling. Workers may finish frames out of order, use a
+// single worker if a callback relies on the order.
+// A 1080p PNG takes a worker about 100ms to compress on a slow core and
+// is around a tenth of the 8.3MB of raw pixels, so three workers keep up
+// with about 30 fps. For 60 fps use more workers, or Raw or Callback,
+// which only copy the pixels but Raw has to write about 500MB/s.
+// capture(), update() and finish() have to be called on the context
+// thread. Needs GL 4.4 for persistently mapped buffers.
+class FrameCapture {
+  public:
+	enum class Output {
+		PNG,
+		Raw,
+		Callback
+	};
+	// Called on a worker thread, the frame may be modified or moved
+	typedef std::function<void(CapturedFrame&)> Callback;
+
+  private:
+	enum class SlotState {
+		// Ready for a new capture
+		Free,
+		// Waiting for the graphics card
+		Pending,
+		// Being read by a worker
+		Reading
+	};
+	struct Slot {
+		unsigned int pbo = 0;
+		// Persistently mapped storage and its size in bytes
+		const unsigned char* mapped = nullptr;
+		size_t capacity = 0;
+		GLsync fence = nullptr;
+		unsigned int width = 0;
+		unsigned int height = 0;
+		uint64_t index = 0;
+		std::atomic<SlotState> state{SlotState::Free};
+	};
+	std::vector<Slot> slots;
+	// Slot the next capture goes to, captures use the ring in order
+	unsigned int nextSlot;
+	// Slot of the oldest capture still waiting for its fence
+	unsigned int oldestPending;
+	uint64_t frameIndex;
+	Output output;
+	// printf pattern for the file names with the frame index
+	std::string pattern;
+	Callback callback;
+	// Slots waiting for a worker
+	std::deque<unsigned int> jobs;
+	std::mutex mutex;
+	std::condition_variable jobsChanged;
+	std::condition_variable slotsChanged;
+	unsigned int busyWorkers;
+	bool stopping;
+	std::vector<std::thread> workers;
+	// Pixel buffers that can be reused for frames
+	std::vector<std::vector<unsigned char>> pixelPool;
+	std::atomic<uint64_t> captured;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> delivered;
+	bool resizeSlot(Slot& S, size_t bytes);
+	// Hand all slots with signaled fences to the workers
+	// and optionally wait for all pending ones
+	void collect(bool wait);
+	void work();
+	void deliver(CapturedFrame& F);
+
+  public:
+	FrameCapture(unsigned int workerCount = 3, unsigned int ringSize = 4);
+	~FrameCapture();
+	// Where finished frames go
+	// The pattern gets the frame index, e.g. "capture/frame_%06llu.png"
+	void setOutput(Output O, const std::string& pattern_ = "");
+	void setCallback(Callback C);
+	// Queue a readback of a region of the current read framebuffer
+	// Returns false if the frame had to be dropped
+	bool capture(int x, int y, unsigned int width, unsigned int height);
+	// Pass finished readbacks on, call this once per frame
+	void update();
+	// Wait until every queued frame has been delivered
+	void finish();
+	// Statistics
+	inline uint64_t capturedFrames() const { return captured; };
+	inline uint64_t droppedFrames() const { return dropped; };
+	inline uint64_t deliveredFrames() const { return delivered; };
+};
+
+#endif
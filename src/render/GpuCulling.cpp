@@ -0,0 +1,227 @@
+#include "GpuCulling.h"
+
+#include <algorithm>
+#include <string>
+
+#include "../shaders/Shaders.h"
+#include "../util/GLHelper.h"
+#include "../util/MemoryStats.h"
+#include "../util/Profiler.h"
+
+namespace {
+	const char* cullingShaderSource = R"(#version 430
+layout(local_size_x = 64) in;
+
+struct Mesh {
+	vec4 sphere;
+	uint firstIndex;
+	uint indexCount;
+	int baseVertex;
+	uint padding;
+};
+
+struct DrawElementsIndirectCommand {
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Meshes {
+	Mesh meshes[];
+};
+
+layout(std430, binding = 1) writeonly buffer Commands {
+	DrawElementsIndirectCommand commands[];
+};
+
+layout(binding = 0, offset = 0) uniform atomic_uint drawCount;
+
+uniform vec4 planes[6];
+uniform uint meshCount;
+uniform bool compact;
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if(i >= meshCount) return;
+	Mesh m = meshes[i];
+	bool visible = true;
+	for(int p = 0; p < 6; p++) {
+		if(dot(planes[p].xyz, m.sphere.xyz) + planes[p].w < -m.sphere.w) visible = false;
+	}
+	if(compact) {
+		if(!visible) return;
+		uint slot = atomicCounterIncrement(drawCount);
+		commands[slot] = DrawElementsIndirectCommand(m.indexCount, 1u, m.firstIndex, m.baseVertex, i);
+	} else {
+		commands[i] = DrawElementsIndirectCommand(m.indexCount, visible ? 1u : 0u, m.firstIndex, m.baseVertex, i);
+	}
+}
+)";
+
+	// Size of a DrawElementsIndirectCommand
+	constexpr unsigned int COMMAND_SIZE = 5 * sizeof(unsigned int);
+
+	bool hasDrawCount()
+	{
+		return GLHelper::hasVersion(4, 6) || GLHelper::hasExtension("GL_ARB_indirect_parameters");
+	}
+} // namespace
+
+GpuCulling::GpuCulling() :
+	meshes(0),
+	dirty(true),
+	program(0),
+	planesLocation(-1),
+	meshCountLocation(-1),
+	compactLocation(-1),
+	meshBuffer(0),
+	commandBuffer(0),
+	counterBuffer(0),
+	capacity(0),
+	storageBytes(0),
+	drawCountSupported(hasDrawCount()),
+	drawCountEnabled(drawCountSupported),
+	useable(false)
+{
+	unsigned int shader = compileShaderSource(GL_COMPUTE_SHADER, cullingShaderSource, "GPU culling shader");
+	if(shader == 0) return;
+	program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDeleteShader(shader);
+	GLint isLinked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+	if(isLinked == GL_FALSE) {
+		printf("Error: Can't link the GPU culling shader\n");
+		return;
+	}
+	planesLocation = glGetUniformLocation(program, "planes");
+	meshCountLocation = glGetUniformLocation(program, "meshCount");
+	compactLocation = glGetUniformLocation(program, "compact");
+	glGenBuffers(1, &meshBuffer);
+	glGenBuffers(1, &commandBuffer);
+	glGenBuffers(1, &counterBuffer);
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffer);
+	glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(unsigned int), nullptr, GL_DYNAMIC_DRAW);
+	storageBytes = sizeof(unsigned int);
+	MemoryStats::allocate(MemoryStats::Category::StorageBuffer, storageBytes);
+	useable = true;
+}
+
+GpuCulling::~GpuCulling()
+{
+	if(useable) MemoryStats::release(MemoryStats::Category::StorageBuffer, storageBytes);
+	if(counterBuffer) glDeleteBuffers(1, &counterBuffer);
+	if(commandBuffer) glDeleteBuffers(1, &commandBuffer);
+	if(meshBuffer) glDeleteBuffers(1, &meshBuffer);
+	if(program) glDeleteProgram(program);
+}
+
+unsigned int GpuCulling::addMesh(unsigned int firstIndex, unsigned int indexCount, const glm::vec4& sphere, int baseVertex)
+{
+	meshes.push_back({sphere, firstIndex, indexCount, baseVertex, 0});
+	dirty = true;
+	return meshes.size() - 1;
+}
+
+void GpuCulling::setSphere(unsigned int mesh, const glm::vec4& sphere)
+{
+	meshes[mesh].sphere = sphere;
+	dirty = true;
+}
+
+void GpuCulling::clear()
+{
+	meshes.clear();
+	dirty = true;
+}
+
+bool GpuCulling::upload()
+{
+	if(!dirty) return false;
+	if(meshes.size() > capacity) {
+		// Grow both buffers together
+		capacity = std::max((unsigned int) meshes.size(), capacity * 2);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(MeshRecord) * capacity, nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, COMMAND_SIZE * capacity, nullptr, GL_DYNAMIC_DRAW);
+		int64_t bytes = (sizeof(MeshRecord) + COMMAND_SIZE) * capacity + sizeof(unsigned int);
+		MemoryStats::resize(MemoryStats::Category::StorageBuffer, storageBytes, bytes);
+		storageBytes = bytes;
+	}
+	if(meshes.size()) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(MeshRecord) * meshes.size(), &meshes[0]);
+		PROFILE_COUNT_UPLOAD(sizeof(MeshRecord) * meshes.size());
+	}
+	dirty = false;
+	return true;
+}
+
+bool GpuCulling::cull(const Culling::Frustum& F)
+{
+	if(!useable || meshes.empty()) return false;
+	PROFILE_CPU_ZONE("GpuCulling::cull");
+	PROFILE_GPU_ZONE("GPU culling");
+	upload();
+	// Reset the counter
+	const unsigned int zero = 0;
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffer);
+	glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(zero), &zero);
+	glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counterBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, meshBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+	glUseProgram(program);
+	glUniform4fv(planesLocation, 6, glm::value_ptr(F.planes[0]));
+	glUniform1ui(meshCountLocation, meshes.size());
+	glUniform1i(compactLocation, drawCountEnabled);
+	glDispatchCompute((meshes.size() + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+	// The commands and the counter are read by the draw
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+	PROFILE_COUNT_BINDS(7);
+	return true;
+}
+
+bool GpuCulling::draw(BaseGlObject& object)
+{
+	if(!useable || meshes.empty()) return false;
+	// Instance attributes would be fetched at the mesh index
+	if(object.hasInstanceAttributes()) {
+		printf("Error: GpuCulling can't draw objects with instance attributes\n");
+		return false;
+	}
+	if(drawCountEnabled) {
+		return object.drawObjectIndirect(commandBuffer, meshes.size(), counterBuffer);
+	}
+	return object.drawObjectIndirect(commandBuffer, meshes.size());
+}
+
+bool GpuCulling::setDrawCount(bool enable)
+{
+	if(enable && !drawCountSupported) return false;
+	drawCountEnabled = enable;
+	return true;
+}
+
+void GpuCulling::readVisible(std::vector<unsigned int>& visible)
+{
+	if(!useable || meshes.empty()) return;
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	unsigned int count = meshes.size();
+	if(drawCountEnabled) {
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffer);
+		glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(count), &count);
+		count = std::min(count, (unsigned int) meshes.size());
+	}
+	// count, instanceCount, firstIndex, baseVertex, baseInstance
+	std::vector<unsigned int> commands(5 * count);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+	if(count) glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, COMMAND_SIZE * count, commands.data());
+	for(unsigned int c = 0; c < count; c++) {
+		if(commands[5 * c + 1]) visible.push_back(commands[5 * c + 4]);
+	}
+}
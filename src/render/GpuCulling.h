@@ -0,0 +1,83 @@
+#ifndef GPU_CULLING_H_DEFINED
+#define GPU_CULLING_H_DEFINED
+
+#include <vector>
+
+#include <GLInclude.h>
+
+#include <glm/glm.hpp>
+
+#include "../objects/BaseGlObject.h"
+#include "Culling.h"
+
+// Frustum culling on the GPU for many meshes stored in one BaseGlObject
+// Every mesh is a range of the object's index data with a bounding
+// sphere. A compute shader tests all spheres and writes a
+// DrawElementsIndirectCommand for every visible mesh, so the CPU never
+// looks at per mesh visibility.
+// With GL 4.6 or ARB_indirect_parameters the commands are compacted
+// with an atomic counter and drawn with glMultiDrawElementsIndirectCount
+// (or its ARB version below 4.6). Otherwise every mesh keeps its command
+// and culled meshes get an instance count of 0.
+// The mesh index is passed as the base instance (gl_BaseInstance), so
+// objects with instance attributes can't be drawn.
+// Needs GL 4.3 for compute shaders and storage buffers.
+class GpuCulling {
+  private:
+	// Matches the std430 layout in the shader
+	struct MeshRecord {
+		glm::vec4 sphere;
+		unsigned int firstIndex;
+		unsigned int indexCount;
+		int baseVertex;
+		unsigned int padding;
+	};
+	std::vector<MeshRecord> meshes;
+	// Meshes changed since the last upload
+	bool dirty;
+	unsigned int program;
+	GLint planesLocation;
+	GLint meshCountLocation;
+	GLint compactLocation;
+	// Mesh records, read by the shader
+	unsigned int meshBuffer;
+	// Commands, written by the shader
+	unsigned int commandBuffer;
+	// Atomic counter, also used as the parameter buffer for the draw
+	unsigned int counterBuffer;
+	// Number of meshes the buffers have room for
+	unsigned int capacity;
+	// Bytes reported to MemoryStats
+	int64_t storageBytes;
+	bool drawCountSupported;
+	bool drawCountEnabled;
+	bool useable;
+	bool upload();
+
+  public:
+	// Size of the work groups in the shader
+	static constexpr unsigned int GROUP_SIZE = 64;
+	GpuCulling();
+	~GpuCulling();
+	inline bool isUseable() const { return useable; };
+	// Whether the compacting path with a draw count is used
+	inline bool usesDrawCount() const { return drawCountEnabled; };
+	// Disabling forces the instance count path, enabling fails if the
+	// context has no draw count
+	bool setDrawCount(bool enable);
+	// Add the index range [firstIndex, firstIndex + indexCount) as a mesh
+	// and return its index
+	unsigned int addMesh(unsigned int firstIndex, unsigned int indexCount, const glm::vec4& sphere, int baseVertex = 0);
+	void setSphere(unsigned int mesh, const glm::vec4& sphere);
+	void clear();
+	inline unsigned int size() const { return meshes.size(); };
+	// Run the culling shader
+	bool cull(const Culling::Frustum& F);
+	// Draw the visible meshes of the object the ranges refer to
+	bool draw(BaseGlObject& object);
+	// Append the meshes the last cull() kept, in no particular order
+	// Reads the buffers back and waits for the GPU, meant for testing.
+	void readVisible(std::vector<unsigned int>& visible);
+};
+
+#endif
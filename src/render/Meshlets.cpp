@@ -0,0 +1,239 @@
+#include "Meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../util/Profiler.h"
+
+namespace {
+	glm::vec3 vertexPosition(const std::pmr::vector<float>& vertexData, const AttributeLayout& L, unsigned int index)
+	{
+		const AttributeLocation& P = L.getPosition();
+		const float* p = &vertexData[(size_t) index * L.size() + P.offsetInGL];
+		return glm::vec3(p[0], p[1], (P.size > 2) ? p[2] : 0.0f);
+	}
+} // namespace
+
+bool MeshletSet::build(BaseGlObject& object)
+{
+	PROFILE_CPU_ZONE("MeshletSet::build");
+	clear();
+	if(!object.Layout.hasPosition()) {
+		printf("Error: Meshlets need a layout with a position attribute\n");
+		return false;
+	}
+	if(!object.cpuDataResident) object.ensureCpuData();
+	const std::pmr::vector<unsigned int>& indices = object.indexData;
+	const unsigned int triangles = object.numberOfIndices / 3;
+	const unsigned int vertexCount = object.numberOfVertices;
+	// Triangles of every vertex, stored compressed
+	std::vector<unsigned int> adjacencyStart(vertexCount + 1, 0);
+	for(unsigned int i = 0; i < triangles * 3; i++)
+		adjacencyStart[indices[i] + 1]++;
+	for(unsigned int v = 0; v < vertexCount; v++)
+		adjacencyStart[v + 1] += adjacencyStart[v];
+	std::vector<unsigned int> adjacency(triangles * 3);
+	{
+		std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+		for(unsigned int i = 0; i < triangles * 3; i++)
+			adjacency[fill[indices[i]]++] = i / 3;
+	}
+	std::vector<bool> emitted(triangles, false);
+	// Meshlet + 1 a vertex was last added to
+	std::vector<unsigned int> stamp(vertexCount, 0);
+	std::vector<unsigned int> current;
+	current.reserve(MAX_VERTICES);
+	// Same resource as the object, so it can be swapped in
+	std::pmr::vector<unsigned int> reordered(object.indexData.get_allocator());
+	reordered.reserve(triangles * 3);
+	unsigned int seed = 0;
+	unsigned int done = 0;
+	while(done < triangles) {
+		const unsigned int id = meshlets.size() + 1;
+		Meshlet M;
+		M.firstIndex = reordered.size();
+		M.triangleCount = 0;
+		current.clear();
+		auto newVertices = [&](unsigned int t) -> unsigned int {
+			return (stamp[indices[3 * t]] != id) + (stamp[indices[3 * t + 1]] != id) + (stamp[indices[3 * t + 2]] != id);
+		};
+		while(M.triangleCount < MAX_TRIANGLES) {
+			// The neighbour adding the fewest vertices
+			unsigned int best = triangles;
+			unsigned int bestNew = 4;
+			for(unsigned int v : current) {
+				for(unsigned int a = adjacencyStart[v]; (a < adjacencyStart[v + 1]) && bestNew; a++) {
+					unsigned int t = adjacency[a];
+					if(emitted[t]) continue;
+					unsigned int n = newVertices(t);
+					if(n < bestNew) {
+						best = t;
+						bestNew = n;
+					}
+				}
+				if(bestNew == 0) break;
+			}
+			// Nothing connected left, continue with the next unused triangle
+			if(best == triangles) {
+				while((seed < triangles) && emitted[seed])
+					seed++;
+				if(seed == triangles) break;
+				best = seed;
+				bestNew = newVertices(seed);
+			}
+			if(current.size() + bestNew > MAX_VERTICES) break;
+			for(unsigned int c = 0; c < 3; c++) {
+				unsigned int v = indices[3 * best + c];
+				if(stamp[v] != id) {
+					stamp[v] = id;
+					current.push_back(v);
+				}
+				reordered.push_back(v);
+			}
+			emitted[best] = true;
+			M.triangleCount++;
+			done++;
+		}
+		M.vertexCount = current.size();
+		// The new order is only swapped into the object at the end
+		computeBounds(M, object, current, &reordered[M.firstIndex]);
+		meshlets.push_back(M);
+		spheres.add(M.sphere);
+	}
+	// The object now draws the triangles in meshlet order
+	object.indexData.swap(reordered);
+	if(object.graphicsCardStatus == 1) object.graphicsCardStatus = -1;
+	return true;
+}
+
+void MeshletSet::computeBounds(Meshlet& M, const BaseGlObject& object, const std::vector<unsigned int>& vertices, const unsigned int* triangleIndices) const
+{
+	// Sphere around the bounding box
+	glm::vec3 min = vertexPosition(object.vertexData, object.Layout, vertices[0]);
+	glm::vec3 max = min;
+	for(unsigned int v : vertices) {
+		glm::vec3 p = vertexPosition(object.vertexData, object.Layout, v);
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+	glm::vec3 center = (min + max) * 0.5f;
+	float radius = 0;
+	for(unsigned int v : vertices) {
+		radius = std::max(radius, glm::length(vertexPosition(object.vertexData, object.Layout, v) - center));
+	}
+	M.sphere = glm::vec4(center, radius);
+	// Normal cone around the average normal
+	std::vector<glm::vec3> normals;
+	normals.reserve(M.triangleCount);
+	glm::vec3 sum(0.0f);
+	for(unsigned int t = 0; t < M.triangleCount; t++) {
+		const unsigned int* i = triangleIndices + 3 * t;
+		glm::vec3 a = vertexPosition(object.vertexData, object.Layout, i[0]);
+		glm::vec3 b = vertexPosition(object.vertexData, object.Layout, i[1]);
+		glm::vec3 c = vertexPosition(object.vertexData, object.Layout, i[2]);
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float l = glm::length(n);
+		// Degenerate triangles don't face anywhere
+		if(l <= 0) continue;
+		normals.push_back(n * (1.0f / l));
+		sum += normals.back();
+	}
+	M.coneAxis = glm::vec3(0.0f);
+	M.coneCutoff = 1;
+	float l = glm::length(sum);
+	if(l <= 0) return;
+	M.coneAxis = sum * (1.0f / l);
+	float minDot = 1;
+	for(const glm::vec3& n : normals)
+		minDot = std::min(minDot, glm::dot(n, M.coneAxis));
+	// Cones wider than ~85 degrees are not worth testing
+	if(minDot > 0.1f) M.coneCutoff = std::sqrt(1 - minDot * minDot);
+}
+
+unsigned int MeshletSet::verify(const BaseGlObject& object) const
+{
+	unsigned int invalid = 0;
+	std::vector<glm::vec3> normals;
+	for(const Meshlet& M : meshlets) {
+		glm::vec3 center(M.sphere.x, M.sphere.y, M.sphere.z);
+		bool valid = true;
+		normals.clear();
+		glm::vec3 axis(0.0f);
+		for(unsigned int t = 0; t < M.triangleCount; t++) {
+			const unsigned int* i = &object.indexData[M.firstIndex + 3 * t];
+			glm::vec3 a = vertexPosition(object.vertexData, object.Layout, i[0]);
+			glm::vec3 b = vertexPosition(object.vertexData, object.Layout, i[1]);
+			glm::vec3 c = vertexPosition(object.vertexData, object.Layout, i[2]);
+			for(const glm::vec3& p : {a, b, c}) {
+				if(glm::length(p - center) > M.sphere.w * 1.0001f + 1e-5f) valid = false;
+			}
+			glm::vec3 n = glm::cross(b - a, c - a);
+			float l = glm::length(n);
+			if(l <= 0) continue;
+			normals.push_back(n * (1.0f / l));
+			axis += normals.back();
+		}
+		if(M.coneCutoff < 1) {
+			// Cosine of the widest angle the cone allows
+			const float minDot = std::sqrt(1 - M.coneCutoff * M.coneCutoff);
+			for(const glm::vec3& n : normals) {
+				if(glm::dot(n, M.coneAxis) < minDot - 1e-4f) valid = false;
+			}
+		} else if(!normals.empty() && (glm::length(axis) > 0)) {
+			// A cone around the average normal would have fit
+			axis = glm::normalize(axis);
+			float minDot = 1;
+			for(const glm::vec3& n : normals)
+				minDot = std::min(minDot, glm::dot(n, axis));
+			if(minDot > 0.1f + 1e-4f) valid = false;
+		}
+		if(!valid) invalid++;
+	}
+	return invalid;
+}
+
+void MeshletSet::clear()
+{
+	meshlets.clear();
+	spheres.clear();
+}
+
+bool MeshletSet::backFacing(const Meshlet& M, const glm::vec3& camera)
+{
+	// Conservative for every point of the bounding sphere
+	glm::vec3 center(M.sphere.x, M.sphere.y, M.sphere.z);
+	glm::vec3 d = center - camera;
+	return glm::dot(d, M.coneAxis) >= M.coneCutoff * glm::length(d) + M.sphere.w;
+}
+
+size_t MeshletSet::cull(const Culling::Frustum& F, const glm::vec3& camera, std::vector<unsigned int>& visible_) const
+{
+	size_t before = visible_.size();
+	Culling::cullSpheres(F, spheres, visible_);
+	visible_.erase(std::remove_if(visible_.begin() + before, visible_.end(),
+								  [&](unsigned int i) { return backFacing(meshlets[i], camera); }),
+				   visible_.end());
+	return visible_.size() - before;
+}
+
+bool MeshletSet::draw(BaseGlObject& object, const Culling::Frustum& F, const glm::vec3& camera)
+{
+	PROFILE_CPU_ZONE("MeshletSet::draw");
+	visible.clear();
+	cull(F, camera, visible);
+	// Visible meshlets come in order, neighbours become one range
+	counts.clear();
+	offsets.clear();
+	unsigned int end = (unsigned int) -1;
+	for(unsigned int i : visible) {
+		const Meshlet& M = meshlets[i];
+		if(M.firstIndex == end) {
+			counts.back() += 3 * M.triangleCount;
+		} else {
+			counts.push_back(3 * M.triangleCount);
+			offsets.push_back((const void*) (sizeof(unsigned int) * M.firstIndex));
+		}
+		end = M.firstIndex + 3 * M.triangleCount;
+	}
+	return object.drawObjectRanges(counts.data(), offsets.data(), counts.size());
+}
@@ -0,0 +1,69 @@
+#ifndef MESHLETS_H_DEFINED
+#define MESHLETS_H_DEFINED
+
+#include <vector>
+
+#include <GLInclude.h>
+
+#include <glm/glm.hpp>
+
+#include "../objects/BaseGlObject.h"
+#include "Culling.h"
+
+// Small clusters of triangles with their own bounds
+struct Meshlet {
+	// Center and radius
+	glm::vec4 sphere;
+	// All triangle normals lie within the cone around the axis,
+	// a cutoff of 1 means the cluster is never back facing
+	glm::vec3 coneAxis;
+	float coneCutoff;
+	// Range in the index data of the object
+	unsigned int firstIndex;
+	unsigned int triangleCount;
+	unsigned int vertexCount;
+};
+
+// Splits a large object into meshlets so parts of it can be culled
+// Building reorders the triangles of the object so that every meshlet
+// is a contiguous range of its index data. Triangles are added greedily,
+// preferring neighbours that add no new vertices, so meshlets stay
+// compact. Drawing culls the meshlets against the frustum and their
+// normal cones and draws the surviving ranges with one
+// glMultiDrawElements, merging neighbouring ranges.
+// Frustum and camera have to be given in the space of the object.
+// Build again whenever the object changes.
+class MeshletSet {
+  private:
+	std::vector<Meshlet> meshlets;
+	Culling::SphereSet spheres;
+	// Scratch space for drawing
+	std::vector<unsigned int> visible;
+	std::vector<GLsizei> counts;
+	std::vector<const void*> offsets;
+	// triangleIndices points to the first index of the meshlet
+	void computeBounds(Meshlet& M, const BaseGlObject& object, const std::vector<unsigned int>& vertices, const unsigned int* triangleIndices) const;
+
+  public:
+	// Limits per meshlet, the usual sizes for mesh shaders
+	static constexpr unsigned int MAX_VERTICES = 64;
+	static constexpr unsigned int MAX_TRIANGLES = 124;
+	MeshletSet() = default;
+	// Needs a layout with a position attribute
+	bool build(BaseGlObject& object);
+	void clear();
+	// Number of meshlets whose sphere doesn't contain all their vertices,
+	// whose cone doesn't contain all their triangle normals or that have
+	// no cone although their normals fit into one
+	unsigned int verify(const BaseGlObject& object) const;
+	// Whether all triangles of the meshlet face away from the camera
+	static bool backFacing(const Meshlet& M, const glm::vec3& camera);
+	// Append the indices of all visible meshlets and return how many there were
+	size_t cull(const Culling::Frustum& F, const glm::vec3& camera, std::vector<unsigned int>& visible_) const;
+	// Draw the visible meshlets of the object this set was built for
+	bool draw(BaseGlObject& object, const Culling::Frustum& F, const glm::vec3& camera);
+	inline const std::vector<Meshlet>& get() const { return meshlets; };
+	inline size_t size() const { return meshlets.size(); };
+};
+
+#endif
@@ -0,0 +1,522 @@
+#include "NoiseBaker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+#include "../shaders/Shaders.h"
+#include "../util/GLHelper.h"
+#include "../util/GLResources.h"
+#include "../util/MemoryStats.h"
+#include "../util/Profiler.h"
+
+namespace {
+	const char* bakeShaderSource = R"(
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+// Same layout as UBOPerlinNoise, the ints are tightly packed
+layout(std140, binding = 2) uniform PerlinNoiseTables {
+	ivec4 hashPacked[64];
+	vec4 vectors[256];
+};
+
+#ifdef TILE_3D
+layout(r16f, binding = 0) writeonly uniform image3D tile;
+#else
+layout(r16f, binding = 0) writeonly uniform image2D tile;
+#endif
+
+uniform ivec3 origin;
+uniform float frequency;
+uniform float lacunarity;
+uniform float gain;
+uniform int octaves;
+
+int hash(int i)
+{
+	i &= 255;
+	return hashPacked[i >> 2][i & 3];
+}
+
+float gradient(ivec3 c, vec3 p)
+{
+	return dot(vectors[hash(hash(hash(c.x) + c.y) + c.z)].xyz, p - vec3(c));
+}
+
+float perlin(vec3 p)
+{
+	ivec3 c = ivec3(floor(p));
+	vec3 f = p - vec3(c);
+	vec3 u = f * f * f * (f * (f * 6.0 - 15.0) + 10.0);
+	float x00 = mix(gradient(c, p), gradient(c + ivec3(1, 0, 0), p), u.x);
+	float x10 = mix(gradient(c + ivec3(0, 1, 0), p), gradient(c + ivec3(1, 1, 0), p), u.x);
+	float x01 = mix(gradient(c + ivec3(0, 0, 1), p), gradient(c + ivec3(1, 0, 1), p), u.x);
+	float x11 = mix(gradient(c + ivec3(0, 1, 1), p), gradient(c + ivec3(1, 1, 1), p), u.x);
+	return mix(mix(x00, x10, u.y), mix(x01, x11, u.y), u.z);
+}
+
+void main()
+{
+	ivec3 t = ivec3(gl_GlobalInvocationID);
+#ifdef TILE_3D
+	if(any(greaterThanEqual(t, imageSize(tile)))) return;
+#else
+	if(any(greaterThanEqual(t.xy, imageSize(tile)))) return;
+#endif
+	vec3 p = vec3(origin + t);
+	float f = frequency;
+	float a = 1.0;
+	float sum = 0.0;
+	float total = 0.0;
+	for(int o = 0; o < octaves; o++) {
+		sum += a * perlin(p * f);
+		total += a;
+		f *= lacunarity;
+		a *= gain;
+	}
+#ifdef TILE_3D
+	imageStore(tile, t, vec4(sum / total));
+#else
+	imageStore(tile, t.xy, vec4(sum / total));
+#endif
+}
+)";
+
+	const uint32_t CACHE_MAGIC = 0x544e474a; // "JGNT"
+	const uint32_t CACHE_VERSION = 1;
+
+	// Tiles are packed into 21 bits per coordinate
+	uint64_t packTile(int x, int y, int z)
+	{
+		return (((uint64_t) x & 0x1fffff) << 42) | (((uint64_t) y & 0x1fffff) << 21) | ((uint64_t) z & 0x1fffff);
+	}
+
+	void unpackTile(uint64_t key, int& x, int& y, int& z)
+	{
+		int* c[3] = {&z, &y, &x};
+		for(int i = 0; i < 3; i++) {
+			int v = (key >> (21 * i)) & 0x1fffff;
+			*c[i] = (v & 0x100000) ? (v - 0x200000) : v;
+		}
+	}
+
+	// First texel of a tile, neighbours share their edges
+	// 2D tiles use z as the slice through the noise
+	void tileOrigin(const NoiseParameters& P, int x, int y, int z, int origin[3])
+	{
+		origin[0] = x * (int) (P.tileSize - 1);
+		origin[1] = y * (int) (P.tileSize - 1);
+		origin[2] = (P.tileDepth > 1) ? z * (int) (P.tileDepth - 1) : z;
+	}
+
+	float fade(float t)
+	{
+		return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+	}
+
+	float lerp(float a, float b, float t)
+	{
+		return a + (b - a) * t;
+	}
+
+	uint64_t hashBytes(uint64_t h, const void* data, size_t length)
+	{
+		const unsigned char* d = (const unsigned char*) data;
+		for(size_t i = 0; i < length; i++) {
+			h ^= d[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	uint64_t hashSettings(const UBOPerlinNoise& T, const NoiseParameters& P)
+	{
+		uint64_t h = 14695981039346656037ull;
+		h = hashBytes(h, T.hash, sizeof(T.hash));
+		h = hashBytes(h, T.vectors, sizeof(T.vectors));
+		// Member by member to skip any padding
+		h = hashBytes(h, &P.octaves, sizeof(P.octaves));
+		h = hashBytes(h, &P.frequency, sizeof(P.frequency));
+		h = hashBytes(h, &P.lacunarity, sizeof(P.lacunarity));
+		h = hashBytes(h, &P.gain, sizeof(P.gain));
+		h = hashBytes(h, &P.tileSize, sizeof(P.tileSize));
+		h = hashBytes(h, &P.tileDepth, sizeof(P.tileDepth));
+		return h;
+	}
+} // namespace
+
+NoiseBaker::NoiseBaker(const UBOPerlinNoise& tables_, const NoiseParameters& params_, const std::string& cacheDirectory_, unsigned int workerCount) :
+	tables(tables_),
+	params(params_),
+	cacheDirectory(cacheDirectory_),
+	cacheKey(hashSettings(tables_, params_)),
+	backend(Backend::CPU),
+	stopping(false),
+	program(0),
+	tablesBuffer(0),
+	originLocation(-1),
+	frequencyLocation(-1),
+	lacunarityLocation(-1),
+	gainLocation(-1),
+	octavesLocation(-1),
+	bakedTiles(0),
+	loadedTiles(0)
+{
+	if((params.tileSize < 2) || (params.tileDepth < 1) || (params.octaves < 1)) {
+		throw std::invalid_argument("Noise tiles need at least 2 texels per side and one octave\n");
+	}
+	for(unsigned int i = 0; i < std::max(1u, workerCount); i++) {
+		workers.push_back(std::thread(&NoiseBaker::work, this));
+	}
+}
+
+NoiseBaker::~NoiseBaker()
+{
+	{
+		// Tiles still waiting are not needed anymore, but
+		// let the workers write the ones that are baked
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [](const Job& J) { return J.texels.empty(); }), jobs.end());
+		stopping = true;
+	}
+	jobsChanged.notify_all();
+	for(std::thread& T : workers)
+		T.join();
+	clear();
+	if(program) glDeleteProgram(program);
+	if(tablesBuffer) {
+		glDeleteBuffers(1, &tablesBuffer);
+		MemoryStats::release(MemoryStats::Category::UniformBuffer, sizeof(UBOPerlinNoise));
+	}
+}
+
+bool NoiseBaker::setupCompute()
+{
+	std::string source = "#version 430\n";
+	if(params.tileDepth > 1) source += "#define TILE_3D\n";
+	unsigned int shader = compileShaderSource(GL_COMPUTE_SHADER, source + bakeShaderSource, "noise baking shader");
+	if(shader == 0) return false;
+	program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDeleteShader(shader);
+	GLint isLinked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+	if(isLinked == GL_FALSE) {
+		printf("Error: Can't link the noise baking shader\n");
+		glDeleteProgram(program);
+		program = 0;
+		return false;
+	}
+	originLocation = glGetUniformLocation(program, "origin");
+	frequencyLocation = glGetUniformLocation(program, "frequency");
+	lacunarityLocation = glGetUniformLocation(program, "lacunarity");
+	gainLocation = glGetUniformLocation(program, "gain");
+	octavesLocation = glGetUniformLocation(program, "octaves");
+	// Our own copy of the tables, they might not be the global ones
+	glGenBuffers(1, &tablesBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, tablesBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(UBOPerlinNoise), &tables, GL_STATIC_DRAW);
+	MemoryStats::allocate(MemoryStats::Category::UniformBuffer, sizeof(UBOPerlinNoise));
+	return true;
+}
+
+bool NoiseBaker::setBackend(Backend B)
+{
+	if((B == Backend::Compute) && (program == 0) && !setupCompute()) {
+		backend = Backend::CPU;
+		return false;
+	}
+	backend = B;
+	return true;
+}
+
+unsigned int NoiseBaker::requestTile(int x, int y, int z)
+{
+	uint64_t key = packTile(x, y, z);
+	std::unordered_map<uint64_t, Tile>::iterator it = tiles.find(key);
+	if(it != tiles.end()) return it->second.texture;
+	tiles[key] = Tile();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back({key, {}, backend == Backend::Compute});
+	}
+	jobsChanged.notify_one();
+	return 0;
+}
+
+unsigned int NoiseBaker::getTile(int x, int y, int z) const
+{
+	std::unordered_map<uint64_t, Tile>::const_iterator it = tiles.find(packTile(x, y, z));
+	return (it != tiles.end()) ? it->second.texture : 0;
+}
+
+void NoiseBaker::update(unsigned int maxTiles)
+{
+	PROFILE_CPU_ZONE("NoiseBaker::update");
+	std::vector<Result> ready;
+	std::vector<uint64_t> compute;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		while(!finished.empty() && (ready.size() < maxTiles)) {
+			ready.push_back(std::move(finished.front()));
+			finished.pop_front();
+		}
+		while(!computeQueue.empty() && (ready.size() + compute.size() < maxTiles)) {
+			compute.push_back(computeQueue.front());
+			computeQueue.pop_front();
+		}
+	}
+	for(Result& R : ready) {
+		std::unordered_map<uint64_t, Tile>::iterator it = tiles.find(R.key);
+		// Evicted while it was generated, or requested again after an
+		// eviction and already done by the newer job
+		if((it == tiles.end()) || (it->second.state != TileState::Queued)) continue;
+		it->second.texture = createTexture(R.texels.data());
+		it->second.state = TileState::Ready;
+		if(R.fromCache) {
+			loadedTiles++;
+		} else {
+			bakedTiles++;
+		}
+	}
+	for(uint64_t key : compute) {
+		std::unordered_map<uint64_t, Tile>::iterator it = tiles.find(key);
+		if((it != tiles.end()) && (it->second.state == TileState::Queued)) bakeCompute(key, it->second);
+	}
+	// Store tiles from the compute backend once they are done
+	for(size_t i = 0; i < pendingSaves.size();) {
+		PendingSave& S = pendingSaves[i];
+		if(glClientWaitSync(S.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			i++;
+			continue;
+		}
+		glDeleteSync(S.fence);
+		Job J = {S.key, std::vector<float>(texelsPerTile()), false};
+		glBindTexture(target(), S.texture);
+		glGetTexImage(target(), 0, GL_RED, GL_FLOAT, J.texels.data());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(J));
+		}
+		jobsChanged.notify_one();
+		pendingSaves[i] = pendingSaves.back();
+		pendingSaves.pop_back();
+	}
+}
+
+void NoiseBaker::bakeCompute(uint64_t key, Tile& T)
+{
+	PROFILE_CPU_ZONE("NoiseBaker::bakeCompute");
+	PROFILE_GPU_ZONE("Noise baking");
+	int x, y, z;
+	unpackTile(key, x, y, z);
+	int origin[3];
+	tileOrigin(params, x, y, z, origin);
+	T.texture = createTexture(nullptr);
+	T.state = TileState::Ready;
+	glUseProgram(program);
+	glBindBufferBase(GL_UNIFORM_BUFFER, TABLES_BINDING, tablesBuffer);
+	glBindImageTexture(0, T.texture, 0, params.tileDepth > 1, 0, GL_WRITE_ONLY, GL_R16F);
+	glUniform3i(originLocation, origin[0], origin[1], origin[2]);
+	glUniform1f(frequencyLocation, params.frequency);
+	glUniform1f(lacunarityLocation, params.lacunarity);
+	glUniform1f(gainLocation, params.gain);
+	glUniform1i(octavesLocation, params.octaves);
+	unsigned int groups = (params.tileSize + 7) / 8;
+	glDispatchCompute(groups, groups, params.tileDepth);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+	PROFILE_COUNT_BINDS(3);
+	bakedTiles++;
+	if(cacheDirectory != "") {
+		pendingSaves.push_back({key, T.texture, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+	}
+}
+
+unsigned int NoiseBaker::createTexture(const float* texels)
+{
+	unsigned int texture;
+	glGenTextures(1, &texture);
+	glBindTexture(target(), texture);
+	if(params.tileDepth > 1) {
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R16F, params.tileSize, params.tileSize, params.tileDepth, 0, GL_RED, GL_FLOAT, texels);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	} else {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, params.tileSize, params.tileSize, 0, GL_RED, GL_FLOAT, texels);
+		GLHelper::setTextureParameters(GL_LINEAR, GL_CLAMP_TO_EDGE);
+	}
+	if(texels) {
+		PROFILE_COUNT_UPLOAD(sizeof(float) * texelsPerTile());
+	}
+	MemoryStats::allocate(MemoryStats::Category::Texture, 2 * texelsPerTile());
+	return texture;
+}
+
+void NoiseBaker::releaseTexture(unsigned int& texture)
+{
+	if(texture == 0) return;
+	// A compute tile that was never saved
+	for(size_t i = 0; i < pendingSaves.size(); i++) {
+		if(pendingSaves[i].texture != texture) continue;
+		glDeleteSync(pendingSaves[i].fence);
+		pendingSaves[i] = pendingSaves.back();
+		pendingSaves.pop_back();
+		break;
+	}
+	// Evicted tiles might still be sampled by frames in flight
+	GLResources::deleteLater(GLResources::Object::Texture, texture);
+	MemoryStats::release(MemoryStats::Category::Texture, 2 * texelsPerTile());
+	texture = 0;
+}
+
+bool NoiseBaker::evict(int x, int y, int z)
+{
+	std::unordered_map<uint64_t, Tile>::iterator it = tiles.find(packTile(x, y, z));
+	if(it == tiles.end()) return false;
+	releaseTexture(it->second.texture);
+	tiles.erase(it);
+	return true;
+}
+
+void NoiseBaker::clear()
+{
+	for(std::pair<const uint64_t, Tile>& T : tiles) {
+		releaseTexture(T.second.texture);
+	}
+	tiles.clear();
+}
+
+void NoiseBaker::work()
+{
+	while(true) {
+		Job J;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobsChanged.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if(jobs.empty()) return;
+			J = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		if(!J.texels.empty()) {
+			saveTile(J.key, J.texels);
+			continue;
+		}
+		Result R;
+		R.key = J.key;
+		R.fromCache = loadTile(J.key, R.texels);
+		if(!R.fromCache) {
+			if(J.compute) {
+				std::lock_guard<std::mutex> lock(mutex);
+				computeQueue.push_back(J.key);
+				continue;
+			}
+			PROFILE_CPU_ZONE("NoiseBaker::bakeTile");
+			int x, y, z;
+			unpackTile(J.key, x, y, z);
+			R.texels.resize(texelsPerTile());
+			bakeTile(tables, params, x, y, z, R.texels.data());
+			saveTile(J.key, R.texels);
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		finished.push_back(std::move(R));
+	}
+}
+
+std::string NoiseBaker::cacheFile(uint64_t key) const
+{
+	int x, y, z;
+	unpackTile(key, x, y, z);
+	char name[96];
+	snprintf(name, sizeof(name), "/noise_%016llx_%d_%d_%d.tile", (unsigned long long) cacheKey, x, y, z);
+	return cacheDirectory + name;
+}
+
+bool NoiseBaker::loadTile(uint64_t key, std::vector<float>& texels) const
+{
+	if(cacheDirectory == "") return false;
+	FILE* f = fopen(cacheFile(key).c_str(), "rb");
+	if(f == nullptr) return false;
+	uint32_t header[4];
+	bool ok = (fread(header, sizeof(uint32_t), 4, f) == 4) && (header[0] == CACHE_MAGIC) && (header[1] == CACHE_VERSION) &&
+			  (header[2] == params.tileSize) && (header[3] == params.tileDepth);
+	if(ok) {
+		texels.resize(texelsPerTile());
+		ok = fread(texels.data(), sizeof(float), texels.size(), f) == texels.size();
+	}
+	fclose(f);
+	if(!ok) texels.clear();
+	return ok;
+}
+
+void NoiseBaker::saveTile(uint64_t key, const std::vector<float>& texels) const
+{
+	if(cacheDirectory == "") return;
+	// Write to a temporary file first so no one reads half a tile
+	std::string name = cacheFile(key);
+	std::string temporary = name + ".tmp";
+	FILE* f = fopen(temporary.c_str(), "wb");
+	if(f == nullptr) {
+		printf("Error: Can't write the noise tile %s\n", name.c_str());
+		return;
+	}
+	uint32_t header[4] = {CACHE_MAGIC, CACHE_VERSION, params.tileSize, params.tileDepth};
+	bool ok = (fwrite(header, sizeof(uint32_t), 4, f) == 4) && (fwrite(texels.data(), sizeof(float), texels.size(), f) == texels.size());
+	fclose(f);
+	if(!ok || rename(temporary.c_str(), name.c_str())) remove(temporary.c_str());
+}
+
+float NoiseBaker::perlin(const UBOPerlinNoise& T, float x, float y, float z)
+{
+	int cx = (int) std::floor(x);
+	int cy = (int) std::floor(y);
+	int cz = (int) std::floor(z);
+	float fx = x - cx;
+	float fy = y - cy;
+	float fz = z - cz;
+	auto hash = [&](int i) { return T.hash[i & 255]; };
+	auto gradient = [&](int gx, int gy, int gz) {
+		const glm::vec4& g = T.vectors[hash(hash(hash(gx) + gy) + gz)];
+		return g.x * (x - gx) + g.y * (y - gy) + g.z * (z - gz);
+	};
+	float u = fade(fx);
+	float v = fade(fy);
+	float w = fade(fz);
+	float x00 = lerp(gradient(cx, cy, cz), gradient(cx + 1, cy, cz), u);
+	float x10 = lerp(gradient(cx, cy + 1, cz), gradient(cx + 1, cy + 1, cz), u);
+	float x01 = lerp(gradient(cx, cy, cz + 1), gradient(cx + 1, cy, cz + 1), u);
+	float x11 = lerp(gradient(cx, cy + 1, cz + 1), gradient(cx + 1, cy + 1, cz + 1), u);
+	return lerp(lerp(x00, x10, v), lerp(x01, x11, v), w);
+}
+
+float NoiseBaker::fbm(const UBOPerlinNoise& T, const NoiseParameters& P, float x, float y, float z)
+{
+	float f = P.frequency;
+	float a = 1;
+	float sum = 0;
+	float total = 0;
+	for(unsigned int o = 0; o < P.octaves; o++) {
+		sum += a * perlin(T, x * f, y * f, z * f);
+		total += a;
+		f *= P.lacunarity;
+		a *= P.gain;
+	}
+	return sum / total;
+}
+
+void NoiseBaker::bakeTile(const UBOPerlinNoise& T, const NoiseParameters& P, int x, int y, int z, float* texels)
+{
+	int origin[3];
+	tileOrigin(P, x, y, z, origin);
+	for(unsigned int k = 0; k < P.tileDepth; k++) {
+		for(unsigned int j = 0; j < P.tileSize; j++) {
+			for(unsigned int i = 0; i < P.tileSize; i++) {
+				*(texels++) = fbm(T, P, (float) (origin[0] + (int) i), (float) (origin[1] + (int) j), (float) (origin[2] + (int) k));
+			}
+		}
+	}
+}
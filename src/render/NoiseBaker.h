@@ -0,0 +1,146 @@
+#ifndef NOISE_BAKER_H_DEFINED
+#define NOISE_BAKER_H_DEFINED
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <GLInclude.h>
+
+#include "../buffers/UniformBufferObjects.h"
+
+// What to bake, changing anything gives different tiles
+struct NoiseParameters {
+	unsigned int octaves = 5;
+	// Of the first octave, in cycles per texel
+	float frequency = 1.0f / 64.0f;
+	// Frequency and amplitude factors from one octave to the next
+	float lacunarity = 2.0f;
+	float gain = 0.5f;
+	// Texels per tile side, a depth of 1 gives 2D tiles
+	unsigned int tileSize = 128;
+	unsigned int tileDepth = 1;
+};
+
+// Bakes fBm of the Perlin noise tables into tiled textures
+// Tiles are requested when they become visible and generated in the
+// background. The CPU backend evaluates the noise on worker threads, the
+// compute backend dispatches a compute shader (GL 4.3) on the context
+// thread. With a cache directory every tile is also stored on disk and
+// loaded from there the next time, the files are keyed by a hash of the
+// tables and the parameters.
+// Neighbouring tiles share their edge texels, sample a tile at
+// (0.5 + u * (size - 1)) / size for u in [0, 1] to get no seams.
+// Textures are single channel GL_R16F, 2D or 3D depending on tileDepth.
+// All functions have to be called on the context thread.
+class NoiseBaker {
+  public:
+	enum class Backend {
+		CPU,
+		Compute
+	};
+	// Binding point of the tables for the compute shader
+	static constexpr unsigned int TABLES_BINDING = 2;
+
+  private:
+	enum class TileState {
+		// Generated in the background
+		Queued,
+		Ready
+	};
+	struct Tile {
+		TileState state = TileState::Queued;
+		unsigned int texture = 0;
+	};
+	struct Job {
+		uint64_t key;
+		// Empty for baking, the texels to store otherwise
+		std::vector<float> texels;
+		// Hand tiles missing in the cache to the compute backend
+		bool compute;
+	};
+	struct Result {
+		uint64_t key;
+		std::vector<float> texels;
+		bool fromCache;
+	};
+	// Texture written by the compute shader that still has to be saved
+	struct PendingSave {
+		uint64_t key;
+		unsigned int texture;
+		GLsync fence;
+	};
+	const UBOPerlinNoise tables;
+	const NoiseParameters params;
+	const std::string cacheDirectory;
+	// Hash of the tables and parameters, part of the cache file names
+	const uint64_t cacheKey;
+	Backend backend;
+	std::unordered_map<uint64_t, Tile> tiles;
+	// Shared with the workers
+	std::mutex mutex;
+	std::condition_variable jobsChanged;
+	std::deque<Job> jobs;
+	std::deque<Result> finished;
+	std::deque<uint64_t> computeQueue;
+	bool stopping;
+	std::vector<std::thread> workers;
+	// Compute backend
+	unsigned int program;
+	unsigned int tablesBuffer;
+	GLint originLocation;
+	GLint frequencyLocation;
+	GLint lacunarityLocation;
+	GLint gainLocation;
+	GLint octavesLocation;
+	std::vector<PendingSave> pendingSaves;
+	uint64_t bakedTiles;
+	uint64_t loadedTiles;
+	bool setupCompute();
+	unsigned int createTexture(const float* texels);
+	void releaseTexture(unsigned int& texture);
+	void bakeCompute(uint64_t key, Tile& T);
+	void work();
+	std::string cacheFile(uint64_t key) const;
+	bool loadTile(uint64_t key, std::vector<float>& texels) const;
+	void saveTile(uint64_t key, const std::vector<float>& texels) const;
+	inline GLenum target() const { return (params.tileDepth > 1) ? GL_TEXTURE_3D : GL_TEXTURE_2D; };
+
+  public:
+	NoiseBaker(const UBOPerlinNoise& tables_, const NoiseParameters& params_, const std::string& cacheDirectory_ = "", unsigned int workerCount = 2);
+	~NoiseBaker();
+	// Switch between the backends, falls back to the CPU if the
+	// compute shader can't be built
+	bool setBackend(Backend B);
+	inline Backend getBackend() const { return backend; };
+	// The texture of a tile, 0 while it is generated
+	// The first request queues the tile
+	unsigned int requestTile(int x, int y, int z = 0);
+	// The texture if the tile is ready, without requesting it
+	unsigned int getTile(int x, int y, int z = 0) const;
+	// Upload finished tiles and run compute bakes, call once per frame
+	// At most maxTiles tiles are uploaded or dispatched per call
+	void update(unsigned int maxTiles = 4);
+	// Delete the texture of a tile that is no longer needed
+	bool evict(int x, int y, int z = 0);
+	void clear();
+	inline size_t size() const { return tiles.size(); };
+	// Tiles evaluated by either backend and tiles read from the disk cache
+	inline uint64_t bakedTileCount() const { return bakedTiles; };
+	inline uint64_t loadedTileCount() const { return loadedTiles; };
+	inline size_t texelsPerTile() const { return (size_t) params.tileSize * params.tileSize * params.tileDepth; };
+	// Gradient noise at a position, about in [-1, 1]
+	static float perlin(const UBOPerlinNoise& T, float x, float y, float z);
+	// Sum of the octaves at a position in texels, normalized by the sum
+	// of the amplitudes. The compute shader does the same.
+	static float fbm(const UBOPerlinNoise& T, const NoiseParameters& P, float x, float y, float z);
+	// Evaluate all texels of a tile on the CPU
+	static void bakeTile(const UBOPerlinNoise& T, const NoiseParameters& P, int x, int y, int z, float* texels);
+};
+
+#endif
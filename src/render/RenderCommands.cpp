@@ -0,0 +1,275 @@
+#include "RenderCommands.h"
+
+#include <algorithm>
+
+#include "../util/Profiler.h"
+
+using namespace RenderCommands;
+
+namespace {
+	struct UniformPayload {
+		const SimpleShaderInfo* shader;
+		GLint location;
+		UniformType type;
+		float value[16];
+	};
+
+	struct BlendPayload {
+		GLenum src;
+		GLenum dst;
+	};
+
+	struct ViewportPayload {
+		int x;
+		int y;
+		int width;
+		int height;
+	};
+
+	struct CallbackPayload {
+		void (*function)(void* userData);
+		void* userData;
+	};
+
+	unsigned int uniformFloats(UniformType type)
+	{
+		switch(type) {
+			case UniformType::Int:
+			case UniformType::Float: return 1;
+			case UniformType::Vec2: return 2;
+			case UniformType::Vec3: return 3;
+			case UniformType::Vec4: return 4;
+			case UniformType::Mat4: return 16;
+		}
+		return 0;
+	}
+
+	// Read a payload back into a properly aligned struct
+	template <typename T>
+	T readPayload(const unsigned char* data)
+	{
+		T t;
+		memcpy(&t, data, sizeof(T));
+		return t;
+	}
+} // namespace
+
+void CommandRecorder::record(uint64_t key, Type type, const void* data, uint32_t size)
+{
+	// Keep every payload 8 byte aligned
+	uint32_t offset = (payload.size() + 7) & ~((size_t) 7);
+	payload.resize(offset + size);
+	if(size) memcpy(&payload[offset], data, size);
+	headers.push_back({key, type, size, offset});
+}
+
+void CommandRecorder::clear()
+{
+	headers.clear();
+	payload.clear();
+}
+
+void CommandRecorder::drawObject(uint64_t key, BaseGlObject* object)
+{
+	record(key, Type::DrawObject, &object, sizeof(object));
+}
+
+void CommandRecorder::drawObjectInstanced(uint64_t key, BaseGlObject* object)
+{
+	record(key, Type::DrawObjectInstanced, &object, sizeof(object));
+}
+
+void CommandRecorder::applyPostProcessing(uint64_t key, const SimpleShaderInfo* shader)
+{
+	record(key, Type::PostProcessing, &shader, sizeof(shader));
+}
+
+void CommandRecorder::setUniform(uint64_t key, const SimpleShaderInfo* shader, GLint location, UniformType type, const void* value)
+{
+	UniformPayload u;
+	u.shader = shader;
+	u.location = location;
+	u.type = type;
+	memcpy(u.value, value, sizeof(float) * uniformFloats(type));
+	// Only store as much of the value as is used
+	record(key, Type::Uniform, &u, offsetof(UniformPayload, value) + sizeof(float) * uniformFloats(type));
+}
+
+void CommandRecorder::enable(uint64_t key, GLenum cap)
+{
+	record(key, Type::Enable, &cap, sizeof(cap));
+}
+
+void CommandRecorder::disable(uint64_t key, GLenum cap)
+{
+	record(key, Type::Disable, &cap, sizeof(cap));
+}
+
+void CommandRecorder::depthMask(uint64_t key, bool write)
+{
+	record(key, Type::DepthMask, &write, sizeof(write));
+}
+
+void CommandRecorder::blendFunc(uint64_t key, GLenum src, GLenum dst)
+{
+	BlendPayload b = {src, dst};
+	record(key, Type::BlendFunc, &b, sizeof(b));
+}
+
+void CommandRecorder::viewport(uint64_t key, int x, int y, int width, int height)
+{
+	ViewportPayload v = {x, y, width, height};
+	record(key, Type::Viewport, &v, sizeof(v));
+}
+
+void CommandRecorder::clear(uint64_t key, GLbitfield mask)
+{
+	record(key, Type::Clear, &mask, sizeof(mask));
+}
+
+void CommandRecorder::callback(uint64_t key, void (*function)(void* userData), void* userData)
+{
+	CallbackPayload c = {function, userData};
+	record(key, Type::Callback, &c, sizeof(c));
+}
+
+RenderFrame::RenderFrame(unsigned int workers) :
+	recorders(std::max(1u, workers))
+{}
+
+size_t RenderFrame::size() const
+{
+	size_t s = 0;
+	for(const CommandRecorder& R : recorders)
+		s += R.size();
+	return s;
+}
+
+RenderQueue::RenderQueue(unsigned int workers, unsigned int framesInFlight) :
+	frames(std::max(1u, framesInFlight), RenderFrame(workers)),
+	states(std::max(1u, framesInFlight), FrameState::Free),
+	nextRecord(0),
+	nextSubmit(0),
+	sorted(0)
+{}
+
+RenderFrame& RenderQueue::beginRecording()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	stateChanged.wait(lock, [this]() { return states[nextRecord] == FrameState::Free; });
+	unsigned int f = nextRecord;
+	nextRecord = (nextRecord + 1) % frames.size();
+	states[f] = FrameState::Recording;
+	lock.unlock();
+	for(CommandRecorder& R : frames[f].recorders)
+		R.clear();
+	return frames[f];
+}
+
+void RenderQueue::endRecording(RenderFrame& frame)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	states[&frame - &frames[0]] = FrameState::Ready;
+	stateChanged.notify_all();
+}
+
+bool RenderQueue::submit(bool wait)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if(wait) {
+		stateChanged.wait(lock, [this]() { return states[nextSubmit] == FrameState::Ready; });
+	} else if(states[nextSubmit] != FrameState::Ready) {
+		return false;
+	}
+	unsigned int f = nextSubmit;
+	nextSubmit = (nextSubmit + 1) % frames.size();
+	states[f] = FrameState::Submitting;
+	lock.unlock();
+
+	PROFILE_CPU_ZONE("RenderQueue::submit");
+	// Merge the commands of all recorders and sort them by key
+	// The sort is stable so equal keys keep the recording order
+	sorted.clear();
+	for(const CommandRecorder& R : frames[f].recorders) {
+		for(uint32_t i = 0; i < R.headers.size(); i++) {
+			sorted.push_back({R.headers[i].key, &R, i});
+		}
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](const SortEntry& l, const SortEntry& r) {
+		return l.key < r.key;
+	});
+	for(const SortEntry& e : sorted) {
+		execute(*e.recorder, e.recorder->headers[e.index]);
+	}
+
+	lock.lock();
+	states[f] = FrameState::Free;
+	stateChanged.notify_all();
+	return true;
+}
+
+void RenderQueue::execute(const CommandRecorder& R, const Header& H)
+{
+	const unsigned char* data = R.payload.data() + H.payloadOffset;
+	switch(H.type) {
+		case Type::DrawObject:
+			readPayload<BaseGlObject*>(data)->drawObject();
+			break;
+		case Type::DrawObjectInstanced:
+			readPayload<BaseGlObject*>(data)->drawObjectInstanced();
+			break;
+		case Type::PostProcessing:
+			readPayload<const SimpleShaderInfo*>(data)->applyPostProcessing();
+			break;
+		case Type::Uniform: {
+			UniformPayload u;
+			memcpy(&u, data, H.payloadSize);
+			if(!u.shader->useable) break;
+			switch(u.type) {
+				case UniformType::Int: glProgramUniform1iv(u.shader->id, u.location, 1, (const GLint*) u.value); break;
+				case UniformType::Float: glProgramUniform1fv(u.shader->id, u.location, 1, u.value); break;
+				case UniformType::Vec2: glProgramUniform2fv(u.shader->id, u.location, 1, u.value); break;
+				case UniformType::Vec3: glProgramUniform3fv(u.shader->id, u.location, 1, u.value); break;
+				case UniformType::Vec4: glProgramUniform4fv(u.shader->id, u.location, 1, u.value); break;
+				case UniformType::Mat4: glProgramUniformMatrix4fv(u.shader->id, u.location, 1, GL_FALSE, u.value); break;
+			}
+			PROFILE_COUNT_UPLOAD(sizeof(float) * uniformFloats(u.type));
+			break;
+		}
+		case Type::BufferUpdate: {
+			void (*apply)(void* target, const unsigned char* value);
+			void* target;
+			memcpy(&apply, data, sizeof(apply));
+			memcpy(&target, data + sizeof(apply), sizeof(target));
+			apply(target, data + sizeof(apply) + sizeof(target));
+			break;
+		}
+		case Type::Enable:
+			glEnable(readPayload<GLenum>(data));
+			break;
+		case Type::Disable:
+			glDisable(readPayload<GLenum>(data));
+			break;
+		case Type::DepthMask:
+			glDepthMask(readPayload<bool>(data) ? GL_TRUE : GL_FALSE);
+			break;
+		case Type::BlendFunc: {
+			BlendPayload b = readPayload<BlendPayload>(data);
+			glBlendFunc(b.src, b.dst);
+			break;
+		}
+		case Type::Viewport: {
+			ViewportPayload v = readPayload<ViewportPayload>(data);
+			glViewport(v.x, v.y, v.width, v.height);
+			break;
+		}
+		case Type::Clear:
+			glClear(readPayload<GLbitfield>(data));
+			break;
+		case Type::Callback: {
+			CallbackPayload c = readPayload<CallbackPayload>(data);
+			c.function(c.userData);
+			break;
+		}
+	}
+}
@@ -0,0 +1,175 @@
+#ifndef RENDER_COMMANDS_H_DEFINED
+#define RENDER_COMMANDS_H_DEFINED
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <GLInclude.h>
+
+#include "../buffers/UniformBufferObjects.h"
+#include "../objects/BaseGlObject.h"
+#include "../shaders/Shaders.h"
+
+// Render commands recorded on any thread and executed on the
+// thread owning the GL context.
+// Every worker records into its own CommandRecorder, which only
+// appends to two linear buffers. On submission the commands of
+// all recorders are merged, sorted by their key and executed.
+// Commands with the same key keep the order they were recorded in
+// (recorder by recorder), so uniforms and state set for a draw
+// should be recorded with the same key as the draw itself.
+// Objects and shaders referenced by commands must stay alive and
+// unchanged until the frame has been submitted.
+
+namespace RenderCommands {
+	enum class Type : uint16_t {
+		DrawObject,
+		DrawObjectInstanced,
+		PostProcessing,
+		Uniform,
+		BufferUpdate,
+		Enable,
+		Disable,
+		DepthMask,
+		BlendFunc,
+		Viewport,
+		Clear,
+		Callback
+	};
+
+	enum class UniformType : uint16_t {
+		Int,
+		Float,
+		Vec2,
+		Vec3,
+		Vec4,
+		Mat4
+	};
+
+	// Build a sort key, layers are executed in order, within a layer
+	// draws are grouped by shader and then ordered by depth
+	inline uint64_t makeKey(uint8_t layer, uint32_t shader, uint32_t depth)
+	{
+		return ((uint64_t) layer << 56) | ((uint64_t) (shader & 0xffffff) << 32) | depth;
+	};
+
+	struct Header {
+		uint64_t key;
+		Type type;
+		uint32_t payloadSize;
+		uint32_t payloadOffset;
+	};
+}; // namespace RenderCommands
+
+// Linear command buffer for a single thread
+class CommandRecorder {
+  private:
+	std::vector<RenderCommands::Header> headers;
+	std::vector<unsigned char> payload;
+	void record(uint64_t key, RenderCommands::Type type, const void* data, uint32_t size);
+
+	friend class RenderQueue;
+
+  public:
+	CommandRecorder() = default;
+	// Drop all commands but keep the memory
+	void clear();
+	inline size_t size() const { return headers.size(); };
+	// Drawing
+	void drawObject(uint64_t key, BaseGlObject* object);
+	void drawObjectInstanced(uint64_t key, BaseGlObject* object);
+	void applyPostProcessing(uint64_t key, const SimpleShaderInfo* shader);
+	// Set a uniform of a program, the program is looked up on execution
+	void setUniform(uint64_t key, const SimpleShaderInfo* shader, GLint location, RenderCommands::UniformType type, const void* value);
+	// Copy a new value into a uniform buffer object and upload it
+	template <typename T>
+	void updateUniformBuffer(uint64_t key, UniformBufferObject<T>& ubo, const T& value);
+	// State
+	void enable(uint64_t key, GLenum cap);
+	void disable(uint64_t key, GLenum cap);
+	void depthMask(uint64_t key, bool write);
+	void blendFunc(uint64_t key, GLenum src, GLenum dst);
+	void viewport(uint64_t key, int x, int y, int width, int height);
+	void clear(uint64_t key, GLbitfield mask);
+	// Anything else, executed on the context thread
+	void callback(uint64_t key, void (*function)(void* userData), void* userData);
+};
+
+// Everything recorded for one frame, one recorder per worker
+class RenderFrame {
+  private:
+	std::vector<CommandRecorder> recorders;
+	friend class RenderQueue;
+
+  public:
+	RenderFrame(unsigned int workers);
+	// Only one thread may record into a recorder at a time
+	inline CommandRecorder& recorder(unsigned int worker) { return recorders[worker]; };
+	inline unsigned int workers() const { return recorders.size(); };
+	size_t size() const;
+};
+
+// Hands recorded frames from the recording threads to the
+// submission thread. With more than one frame, frame N+1 can be
+// recorded while frame N is being submitted.
+class RenderQueue {
+  private:
+	enum class FrameState {
+		Free,
+		Recording,
+		Ready,
+		Submitting
+	};
+	std::vector<RenderFrame> frames;
+	std::vector<FrameState> states;
+	// Frames are recorded and submitted in this order
+	unsigned int nextRecord;
+	unsigned int nextSubmit;
+	std::mutex mutex;
+	std::condition_variable stateChanged;
+	// Reused between submissions
+	struct SortEntry {
+		uint64_t key;
+		const CommandRecorder* recorder;
+		uint32_t index;
+	};
+	std::vector<SortEntry> sorted;
+	void execute(const CommandRecorder& R, const RenderCommands::Header& H);
+
+  public:
+	RenderQueue(unsigned int workers, unsigned int framesInFlight = 2);
+	~RenderQueue() = default;
+	// Recording side, waits until a frame is free
+	RenderFrame& beginRecording();
+	// Pass the frame returned by beginRecording on to the submission
+	void endRecording(RenderFrame& frame);
+	// Context thread, execute the oldest recorded frame
+	// If wait is false and no frame is ready nothing happens
+	bool submit(bool wait = true);
+};
+
+template <typename T>
+void CommandRecorder::updateUniformBuffer(uint64_t key, UniformBufferObject<T>& ubo, const T& value)
+{
+	// Payload: function to apply it, target and the value itself
+	struct Update {
+		void (*apply)(void* target, const unsigned char* value);
+		void* target;
+	};
+	Update u = {
+		[](void* target, const unsigned char* v) {
+			UniformBufferObject<T>* U = (UniformBufferObject<T>*) target;
+			memcpy(&U->get(), v, sizeof(T));
+			U->update();
+		},
+		&ubo};
+	unsigned char data[sizeof(Update) + sizeof(T)];
+	memcpy(data, &u, sizeof(Update));
+	memcpy(data + sizeof(Update), &value, sizeof(T));
+	record(key, RenderCommands::Type::BufferUpdate, data, sizeof(data));
+}
+
+#endif
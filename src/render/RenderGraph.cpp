@@ -0,0 +1,418 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "../util/GLHelper.h"
+#include "../util/GLResources.h"
+#include "../util/MemoryStats.h"
+#include "../util/Profiler.h"
+
+namespace {
+	const char* loadOpName(RenderGraph::LoadOp L)
+	{
+		switch(L) {
+			case RenderGraph::LoadOp::Load: return "load";
+			case RenderGraph::LoadOp::Clear: return "clear";
+			case RenderGraph::LoadOp::DontCare: return "don't care";
+		}
+		return "";
+	}
+} // namespace
+
+RenderGraph::RenderGraph(unsigned int width_, unsigned int height_) :
+	width(width_),
+	height(height_),
+	compiled(false),
+	emptyVao(0)
+{}
+
+RenderGraph::~RenderGraph()
+{
+	clear();
+	for(Physical& P : physical) {
+		deletePhysical(P);
+	}
+	GLResources::deleteLater(GLResources::Object::VertexArray, emptyVao);
+}
+
+void RenderGraph::setSize(unsigned int width_, unsigned int height_)
+{
+	if((width == width_) && (height == height_)) return;
+	width = width_;
+	height = height_;
+	// Textures of the old size are dropped by the next compile()
+	compiled = false;
+}
+
+RenderGraph::Resource RenderGraph::addResource(const std::string& name, const TextureDesc& D, bool imported, unsigned int texture, unsigned int framebuffer, unsigned int w, unsigned int h)
+{
+	ResourceNode R;
+	R.name = name;
+	R.desc = D;
+	R.imported = imported;
+	R.texture = texture;
+	R.framebuffer = framebuffer;
+	R.output = imported;
+	R.width = w;
+	R.height = h;
+	R.physical = -1;
+	R.firstUse = -1;
+	R.lastUse = -1;
+	resources.push_back(R);
+	compiled = false;
+	return resources.size() - 1;
+}
+
+const RenderGraph::ResourceNode& RenderGraph::checkResource(Resource R) const
+{
+	if(R >= resources.size()) {
+		throw std::invalid_argument("Unknown render graph resource\n");
+	}
+	return resources[R];
+}
+
+RenderGraph::Resource RenderGraph::createTexture(const std::string& name, const TextureDesc& D)
+{
+	return addResource(name, D, false, 0, 0, 0, 0);
+}
+
+RenderGraph::Resource RenderGraph::importTexture(const std::string& name, unsigned int texture, unsigned int width_, unsigned int height_)
+{
+	return addResource(name, TextureDesc(), true, texture, 0, width_, height_);
+}
+
+RenderGraph::Resource RenderGraph::importFramebuffer(const std::string& name, unsigned int framebuffer, unsigned int width_, unsigned int height_)
+{
+	return addResource(name, TextureDesc(), true, 0, framebuffer, width_, height_);
+}
+
+void RenderGraph::markOutput(Resource R)
+{
+	checkResource(R);
+	resources[R].output = true;
+	compiled = false;
+}
+
+unsigned int RenderGraph::addPass(const std::string& name, const std::vector<Resource>& reads, Resource write, const Execute& execute, LoadOp load)
+{
+	checkResource(write);
+	for(Resource R : reads) {
+		const ResourceNode& N = checkResource(R);
+		if(R == write) {
+			throw std::invalid_argument(("Render pass " + name + " reads its own target " + N.name + "\n").c_str());
+		}
+		if(N.imported && !N.texture) {
+			throw std::invalid_argument(("Render pass " + name + " reads the framebuffer " + N.name + "\n").c_str());
+		}
+	}
+	PassNode P;
+	P.name = name;
+	P.reads = reads;
+	P.write = write;
+	P.load = load;
+	P.clearColor = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	P.execute = execute;
+	P.live = false;
+	P.merged = false;
+	passes.push_back(std::move(P));
+	compiled = false;
+	return passes.size() - 1;
+}
+
+unsigned int RenderGraph::addPostProcessingPass(const std::string& name, const SimpleShaderInfo* shader, const std::vector<Resource>& reads, Resource write)
+{
+	// The strip covers every pixel, so the old content is never needed
+	return addPass(
+		name, reads, write,
+		[this, shader](const PassContext&) {
+			if(!emptyVao) glGenVertexArrays(1, &emptyVao);
+			glBindVertexArray(emptyVao);
+			shader->applyPostProcessing();
+		},
+		LoadOp::DontCare);
+}
+
+void RenderGraph::setClearColor(unsigned int pass, const glm::vec4& color)
+{
+	passes.at(pass).clearColor = color;
+}
+
+void RenderGraph::clear()
+{
+	resources.clear();
+	passes.clear();
+	for(std::pair<unsigned int, unsigned int>& F : importedFramebuffers) {
+		GLResources::deleteLater(GLResources::Object::Framebuffer, F.second);
+	}
+	importedFramebuffers.clear();
+	compiled = false;
+}
+
+int RenderGraph::acquirePhysical(const ResourceNode& R, int firstUse)
+{
+	for(size_t p = 0; p < physical.size(); p++) {
+		Physical& P = physical[p];
+		if((P.format == R.desc.format) && (P.width == R.width) && (P.height == R.height) && (P.busyUntil < firstUse)) {
+			return p;
+		}
+	}
+	Physical P;
+	P.format = R.desc.format;
+	P.width = R.width;
+	P.height = R.height;
+	P.busyUntil = -1;
+	P.used = false;
+	glGenTextures(1, &P.texture);
+	glBindTexture(GL_TEXTURE_2D, P.texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, P.format, P.width, P.height);
+	GLHelper::setTextureParameters(GL_LINEAR, GL_CLAMP_TO_EDGE);
+	glGenFramebuffers(1, &P.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, P.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, P.texture, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Error: Incomplete framebuffer for render graph texture %s\n", R.name.c_str());
+	}
+	MemoryStats::allocate(MemoryStats::Category::Texture, MemoryStats::textureBytes(P.width, P.height, bytesPerPixel(P.format), false));
+	physical.push_back(P);
+	return physical.size() - 1;
+}
+
+void RenderGraph::deletePhysical(Physical& P)
+{
+	GLResources::deleteLater(GLResources::Object::Framebuffer, P.framebuffer);
+	GLResources::deleteLater(GLResources::Object::Texture, P.texture);
+	MemoryStats::release(MemoryStats::Category::Texture, MemoryStats::textureBytes(P.width, P.height, bytesPerPixel(P.format), false));
+	P.framebuffer = 0;
+	P.texture = 0;
+}
+
+bool RenderGraph::compile()
+{
+	PROFILE_CPU_ZONE("RenderGraph::compile");
+	compiled = false;
+	stats.passes = passes.size();
+	stats.culledPasses = 0;
+	stats.mergedPasses = 0;
+	stats.transientTextures = 0;
+	stats.physicalTextures = 0;
+	stats.textureBytes = 0;
+	stats.unaliasedBytes = 0;
+	// Cull backwards from the outputs, a pass that doesn't load its
+	// target hides every earlier write to it
+	std::vector<bool> needed(resources.size());
+	for(size_t r = 0; r < resources.size(); r++) {
+		needed[r] = resources[r].output;
+	}
+	for(size_t i = passes.size(); i-- > 0;) {
+		PassNode& P = passes[i];
+		P.live = needed[P.write];
+		P.merged = false;
+		P.lastReads.clear();
+		if(!P.live) {
+			stats.culledPasses++;
+			continue;
+		}
+		if(P.load != LoadOp::Load) needed[P.write] = false;
+		for(Resource R : P.reads) {
+			needed[R] = true;
+		}
+	}
+	// Lifetimes of the transient textures in pass indices
+	for(ResourceNode& R : resources) {
+		R.physical = -1;
+		R.firstUse = -1;
+		R.lastUse = -1;
+	}
+	std::vector<bool> written(resources.size(), false);
+	for(size_t i = 0; i < passes.size(); i++) {
+		PassNode& P = passes[i];
+		if(!P.live) continue;
+		for(Resource R : P.reads) {
+			ResourceNode& N = resources[R];
+			if(!N.imported && !written[R]) {
+				printf("Error: Render pass %s reads %s before it is written\n", P.name.c_str(), N.name.c_str());
+				return false;
+			}
+			if(N.firstUse < 0) N.firstUse = i;
+			N.lastUse = i;
+		}
+		ResourceNode& W = resources[P.write];
+		if(!W.imported && !written[P.write] && (P.load == LoadOp::Load)) {
+			printf("Error: Render pass %s loads %s before it is written\n", P.name.c_str(), W.name.c_str());
+			return false;
+		}
+		if(W.firstUse < 0) W.firstUse = i;
+		W.lastUse = i;
+		written[P.write] = true;
+	}
+	// Alias in the order the textures are first used, outputs live to the end
+	std::vector<Resource> order;
+	for(size_t r = 0; r < resources.size(); r++) {
+		ResourceNode& N = resources[r];
+		if(N.imported || (N.firstUse < 0)) continue;
+		if(N.output) {
+			N.lastUse = passes.size();
+		} else {
+			passes[N.lastUse].lastReads.push_back(r);
+		}
+		N.width = N.desc.width ? N.desc.width : std::max(1u, (unsigned int) std::lround(width * N.desc.scale));
+		N.height = N.desc.height ? N.desc.height : std::max(1u, (unsigned int) std::lround(height * N.desc.scale));
+		order.push_back(r);
+	}
+	std::stable_sort(order.begin(), order.end(), [this](Resource a, Resource b) { return resources[a].firstUse < resources[b].firstUse; });
+	for(Physical& P : physical) {
+		P.busyUntil = -1;
+		P.used = false;
+	}
+	for(Resource r : order) {
+		ResourceNode& N = resources[r];
+		N.physical = acquirePhysical(N, N.firstUse);
+		physical[N.physical].busyUntil = N.lastUse;
+		physical[N.physical].used = true;
+		stats.transientTextures++;
+		stats.unaliasedBytes += MemoryStats::textureBytes(N.width, N.height, bytesPerPixel(N.desc.format), false);
+	}
+	// Drop what this graph doesn't need, old sizes included
+	std::vector<int> remap(physical.size(), -1);
+	size_t kept = 0;
+	for(size_t p = 0; p < physical.size(); p++) {
+		if(!physical[p].used) {
+			deletePhysical(physical[p]);
+			continue;
+		}
+		remap[p] = kept;
+		physical[kept++] = physical[p];
+		stats.physicalTextures++;
+		stats.textureBytes += MemoryStats::textureBytes(physical[p].width, physical[p].height, bytesPerPixel(physical[p].format), false);
+	}
+	physical.resize(kept);
+	for(ResourceNode& N : resources) {
+		if(N.physical >= 0) N.physical = remap[N.physical];
+	}
+	// Consecutive passes drawing into the same target keep the framebuffer
+	const PassNode* previous = nullptr;
+	for(PassNode& P : passes) {
+		if(!P.live) continue;
+		if(previous && (previous->write == P.write)) {
+			P.merged = true;
+			stats.mergedPasses++;
+		}
+		previous = &P;
+	}
+	compiled = true;
+	return true;
+}
+
+unsigned int RenderGraph::targetFramebuffer(Resource R)
+{
+	const ResourceNode& N = resources[R];
+	if(!N.imported) return physical[N.physical].framebuffer;
+	if(!N.texture) return N.framebuffer;
+	for(const std::pair<unsigned int, unsigned int>& F : importedFramebuffers) {
+		if(F.first == N.texture) return F.second;
+	}
+	unsigned int framebuffer = 0;
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, N.texture, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Error: Incomplete framebuffer for imported texture %s\n", N.name.c_str());
+	}
+	importedFramebuffers.push_back(std::make_pair(N.texture, framebuffer));
+	return framebuffer;
+}
+
+unsigned int RenderGraph::sourceTexture(Resource R) const
+{
+	const ResourceNode& N = resources[R];
+	return N.imported ? N.texture : physical[N.physical].texture;
+}
+
+bool RenderGraph::execute()
+{
+	if(!compiled && !compile()) return false;
+	PROFILE_CPU_ZONE("RenderGraph::execute");
+	PROFILE_GPU_ZONE("Render graph");
+	std::vector<unsigned int> inputs;
+	for(PassNode& P : passes) {
+		if(!P.live) continue;
+		const ResourceNode& W = resources[P.write];
+		if(!P.merged) {
+			unsigned int framebuffer = targetFramebuffer(P.write);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glViewport(0, 0, W.width, W.height);
+			PROFILE_COUNT_BINDS(1);
+			stats.framebufferBinds++;
+			if(P.load == LoadOp::DontCare) {
+				// The default framebuffer names its attachments differently
+				GLenum attachment = framebuffer ? GL_COLOR_ATTACHMENT0 : GL_COLOR;
+				glInvalidateFramebuffer(GL_FRAMEBUFFER, 1, &attachment);
+				stats.invalidations++;
+			}
+		}
+		if(P.load == LoadOp::Clear) {
+			glClearColor(P.clearColor.x, P.clearColor.y, P.clearColor.z, P.clearColor.w);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+		inputs.clear();
+		for(size_t k = 0; k < P.reads.size(); k++) {
+			inputs.push_back(sourceTexture(P.reads[k]));
+			glActiveTexture(GL_TEXTURE0 + k);
+			glBindTexture(GL_TEXTURE_2D, inputs.back());
+		}
+		PROFILE_COUNT_BINDS(inputs.size());
+		P.execute({inputs.data(), (unsigned int) inputs.size(), W.width, W.height});
+		// Nothing reads these anymore until another resource gets the texture
+		for(Resource R : P.lastReads) {
+			glInvalidateTexImage(physical[resources[R].physical].texture, 0);
+			stats.invalidations++;
+		}
+	}
+	glActiveTexture(GL_TEXTURE0);
+	return true;
+}
+
+unsigned int RenderGraph::getTexture(Resource R) const
+{
+	const ResourceNode& N = checkResource(R);
+	if(N.imported) return N.texture;
+	return (compiled && (N.physical >= 0)) ? physical[N.physical].texture : 0;
+}
+
+std::string RenderGraph::describe() const
+{
+	std::string result;
+	char buffer[512];
+	for(const PassNode& P : passes) {
+		std::string reads;
+		for(Resource R : P.reads) {
+			reads += (reads.empty() ? "" : ", ") + resources[R].name;
+		}
+		const ResourceNode& W = resources[P.write];
+		std::string target = W.imported ? "imported" : (W.physical >= 0 ? "texture " + std::to_string(W.physical) : "none");
+		snprintf(buffer, sizeof(buffer), "%-20s %-8s %s -> %s (%s, %s)\n", P.name.c_str(), !compiled ? "" : (!P.live ? "culled" : (P.merged ? "merged" : "")),
+				 reads.empty() ? "-" : reads.c_str(), W.name.c_str(), target.c_str(), loadOpName(P.load));
+		result += buffer;
+	}
+	snprintf(buffer, sizeof(buffer), "%u passes, %u culled, %u merged, %u transient textures in %u (%.2f MiB instead of %.2f MiB)\n", stats.passes,
+			 stats.culledPasses, stats.mergedPasses, stats.transientTextures, stats.physicalTextures, stats.textureBytes / 1048576.0,
+			 stats.unaliasedBytes / 1048576.0);
+	result += buffer;
+	return result;
+}
+
+unsigned int RenderGraph::bytesPerPixel(GLenum format)
+{
+	switch(format) {
+		case GL_R8: return 1;
+		case GL_RG8:
+		case GL_R16F: return 2;
+		case GL_RGBA16F:
+		case GL_RG32F: return 8;
+		case GL_RGBA32F: return 16;
+		// GL_RGBA8, GL_SRGB8_ALPHA8, GL_RGB10_A2, GL_R11F_G11F_B10F, GL_RG16F, GL_R32F, ...
+		default: return 4;
+	}
+}
@@ -0,0 +1,173 @@
+#ifndef RENDER_GRAPH_H_DEFINED
+#define RENDER_GRAPH_H_DEFINED
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <GLInclude.h>
+#include <glm/glm.hpp>
+
+#include "../shaders/Shaders.h"
+
+// Render graph for chains of fullscreen passes like post processing
+// Every pass declares the textures it reads and the single target it
+// writes. compile() walks the passes backwards from the outputs and culls
+// every pass whose result is never used, then gives each transient texture
+// the range of passes it lives in. Transient textures with the same format
+// and size whose ranges don't overlap share one physical texture, so a
+// chain of any length needs about two full resolution targets.
+// Consecutive passes writing the same target are merged, the framebuffer is
+// only bound once and its content kept. Attachments whose old content is
+// not needed are invalidated before drawing and transient textures are
+// invalidated after their last read, which saves tiled GPUs the loads and
+// stores.
+// Imported textures and framebuffers belong to the caller, they are never
+// aliased and count as outputs. Passes run in the order they were added.
+// Physical textures are kept from one compile() to the next, so a graph
+// can be cleared and rebuilt every frame.
+// compile(), execute() and everything deleting textures have to be
+// called on the context thread.
+class RenderGraph {
+  public:
+	typedef unsigned int Resource;
+	// What happens to the content of the target before a pass draws
+	enum class LoadOp {
+		Load,
+		Clear,
+		// The pass overwrites every pixel
+		DontCare
+	};
+	struct TextureDesc {
+		GLenum format = GL_RGBA8;
+		// Fixed size, or 0 for the size of the graph times scale
+		unsigned int width = 0;
+		unsigned int height = 0;
+		float scale = 1.0f;
+	};
+	struct PassContext {
+		// Textures of the reads in the declared order, bound to units 0, 1, ...
+		const unsigned int* inputs;
+		unsigned int inputCount;
+		// Of the target, the viewport is already set
+		unsigned int width;
+		unsigned int height;
+	};
+	typedef std::function<void(const PassContext&)> Execute;
+	struct Statistics {
+		unsigned int passes = 0;
+		unsigned int culledPasses = 0;
+		// Passes that kept the framebuffer of the previous pass
+		unsigned int mergedPasses = 0;
+		unsigned int transientTextures = 0;
+		unsigned int physicalTextures = 0;
+		// Of the physical textures and what one texture per transient would take
+		int64_t textureBytes = 0;
+		int64_t unaliasedBytes = 0;
+		// Counted by execute()
+		uint64_t framebufferBinds = 0;
+		uint64_t invalidations = 0;
+	};
+
+  private:
+	struct ResourceNode {
+		std::string name;
+		TextureDesc desc;
+		bool imported;
+		// Imported textures and framebuffers, 0 for the default framebuffer
+		unsigned int texture;
+		unsigned int framebuffer;
+		bool output;
+		// Resolved size
+		unsigned int width;
+		unsigned int height;
+		// Index into physical, -1 if imported or unused
+		int physical;
+		// Range of live passes using it, -1 if none
+		int firstUse;
+		int lastUse;
+	};
+	struct PassNode {
+		std::string name;
+		std::vector<Resource> reads;
+		Resource write;
+		LoadOp load;
+		glm::vec4 clearColor;
+		Execute execute;
+		bool live;
+		bool merged;
+		// Transient textures read for the last time by this pass
+		std::vector<Resource> lastReads;
+	};
+	struct Physical {
+		GLenum format;
+		unsigned int width;
+		unsigned int height;
+		unsigned int texture;
+		unsigned int framebuffer;
+		// Last pass of the resource currently assigned, -1 if free
+		int busyUntil;
+		bool used;
+	};
+	std::vector<ResourceNode> resources;
+	std::vector<PassNode> passes;
+	std::vector<Physical> physical;
+	// Framebuffers for writing into imported textures
+	std::vector<std::pair<unsigned int, unsigned int>> importedFramebuffers;
+	unsigned int width;
+	unsigned int height;
+	bool compiled;
+	// Core profiles need a vao even for attributeless draws
+	unsigned int emptyVao;
+	Statistics stats;
+	Resource addResource(const std::string& name, const TextureDesc& D, bool imported, unsigned int texture, unsigned int framebuffer, unsigned int w, unsigned int h);
+	const ResourceNode& checkResource(Resource R) const;
+	int acquirePhysical(const ResourceNode& R, int firstUse);
+	void deletePhysical(Physical& P);
+	// Framebuffer a pass draws into
+	unsigned int targetFramebuffer(Resource R);
+	// Texture a pass reads
+	unsigned int sourceTexture(Resource R) const;
+
+  public:
+	RenderGraph(unsigned int width_, unsigned int height_);
+	~RenderGraph();
+	// Size of the transient textures without a fixed size
+	void setSize(unsigned int width_, unsigned int height_);
+	inline unsigned int getWidth() const { return width; };
+	inline unsigned int getHeight() const { return height; };
+	Resource createTexture(const std::string& name, const TextureDesc& D);
+	inline Resource createTexture(const std::string& name) { return createTexture(name, TextureDesc()); };
+	// A texture of the caller, passes may read and write it
+	Resource importTexture(const std::string& name, unsigned int texture, unsigned int width_, unsigned int height_);
+	// A framebuffer of the caller that can only be written, 0 is the default framebuffer
+	Resource importFramebuffer(const std::string& name, unsigned int framebuffer, unsigned int width_, unsigned int height_);
+	// Keep a transient texture, it can be read with getTexture() after execute()
+	void markOutput(Resource R);
+	// Passes that read their own target are rejected
+	unsigned int addPass(const std::string& name, const std::vector<Resource>& reads, Resource write, const Execute& execute, LoadOp load = LoadOp::DontCare);
+	// Draws the fullscreen strip of a post processing shader, which has
+	// to stay alive as long as the pass
+	unsigned int addPostProcessingPass(const std::string& name, const SimpleShaderInfo* shader, const std::vector<Resource>& reads, Resource write);
+	// Color for passes with LoadOp::Clear
+	void setClearColor(unsigned int pass, const glm::vec4& color);
+	// Remove all passes and resources, physical textures stay for the next graph
+	void clear();
+	// Cull, assign physical textures and merge passes
+	// Fails if a texture is read before any pass wrote it.
+	bool compile();
+	// Compiles first if the graph changed
+	bool execute();
+	// Physical texture of a resource after compile(), 0 if it has none
+	unsigned int getTexture(Resource R) const;
+	inline bool isCulled(unsigned int pass) const { return compiled && !passes[pass].live; };
+	inline const Statistics& getStatistics() const { return stats; };
+	// Passes and the textures they ended up using
+	std::string describe() const;
+	inline void print(FILE* f = stdout) const { fputs(describe().c_str(), f); };
+	static unsigned int bytesPerPixel(GLenum format);
+};
+
+#endif
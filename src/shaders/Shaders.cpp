@@ -2,18 +2,41 @@
 
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+
+#include "../util/GLResources.h"
+#include "../util/Profiler.h"
 
 bool SimpleShaderInfo::use() const
 {
-	if(useable) glUseProgram(id);
+	if(useable) {
+		glUseProgram(id);
+		PROFILE_COUNT_BINDS(1);
+	}
+	return useable;
+}
+
+bool SimpleShaderInfo::dispatchCompute(unsigned int x, unsigned int y, unsigned int z) const
+{
+	if(useable) {
+		PROFILE_CPU_ZONE("SimpleShaderInfo::dispatchCompute");
+		PROFILE_GPU_ZONE("Compute");
+		glUseProgram(id);
+		glDispatchCompute(x, y, z);
+		PROFILE_COUNT_BINDS(1);
+	}
 	return useable;
 }
 
 bool SimpleShaderInfo::applyPostProcessing() const
 {
 	if(useable) {
+		PROFILE_CPU_ZONE("SimpleShaderInfo::applyPostProcessing");
+		PROFILE_GPU_ZONE("Post processing");
 		glUseProgram(id);
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		PROFILE_COUNT_BINDS(1);
+		PROFILE_COUNT_DRAW(2);
 	}
 	return useable;
 }
@@ -27,12 +50,114 @@ GLenum determineShaderType(const std::string& f)
 	std::string ending = f.substr(endingStart + 1);
 	if(ending == "frag") return GL_FRAGMENT_SHADER;
 	if(ending == "vert") return GL_VERTEX_SHADER;
+	if(ending == "comp") return GL_COMPUTE_SHADER;
+	if(ending == "geom") return GL_GEOMETRY_SHADER;
+	if(ending == "tesc") return GL_TESS_CONTROL_SHADER;
+	if(ending == "tese") return GL_TESS_EVALUATION_SHADER;
 	throw std::invalid_argument(("Unknown ending \"" + ending + "\" for: " + f + "\n").c_str());
 }
 
+unsigned int compileShaderSource(GLenum type, const std::string& source, const char* name)
+{
+	unsigned int id = glCreateShader(type);
+	// Compile
+	const char* sourceChar = source.c_str();
+	glShaderSource(id, 1, &sourceChar, NULL);
+	glCompileShader(id);
+	// Check if compiling was successful
+	GLint isCompiled = 0;
+	glGetShaderiv(id, GL_COMPILE_STATUS, &isCompiled);
+	if(isCompiled == GL_FALSE) {
+		printf("Error: Can't compile %s\n", name);
+		printf("Code:\n%s\n", sourceChar);
+		// Print the info log for the sahder
+		GLint maxLength = 0;
+		glGetShaderiv(id, GL_INFO_LOG_LENGTH, &maxLength);
+		std::vector<GLchar> errorLog(maxLength);
+		glGetShaderInfoLog(id, maxLength, &maxLength, &errorLog[0]);
+		for(GLchar c : errorLog)
+			printf("%c", (char) c);
+		printf("\n");
+		// Delete the shader
+		glDeleteShader(id);
+		return 0;
+	}
+	return id;
+}
+
+namespace {
+	struct CachedShader {
+		GLenum type;
+		std::string source;
+		unsigned int id;
+		unsigned int users;
+	};
+	// Hash of the source to the shaders with that hash
+	std::unordered_multimap<uint64_t, CachedShader> cachedShaders;
+	std::unordered_map<unsigned int, uint64_t> cachedShaderHashes;
+	uint64_t cacheHits = 0;
+
+	uint64_t hashSource(GLenum type, const std::string& source)
+	{
+		// FNV-1a, seeded with the type
+		uint64_t h = 14695981039346656037ull ^ type;
+		for(unsigned char c : source) {
+			h ^= c;
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+} // namespace
+
+unsigned int ShaderCache::acquire(GLenum type, const std::string& source, const char* name)
+{
+	uint64_t h = hashSource(type, source);
+	auto range = cachedShaders.equal_range(h);
+	for(auto it = range.first; it != range.second; ++it) {
+		CachedShader& C = it->second;
+		if((C.type == type) && (C.source == source)) {
+			C.users++;
+			cacheHits++;
+			return C.id;
+		}
+	}
+	unsigned int id = compileShaderSource(type, source, name);
+	if(id == 0) return 0;
+	cachedShaders.insert({h, {type, source, id, 1}});
+	cachedShaderHashes[id] = h;
+	return id;
+}
+
+void ShaderCache::release(unsigned int id)
+{
+	auto found = cachedShaderHashes.find(id);
+	if(found == cachedShaderHashes.end()) return;
+	auto range = cachedShaders.equal_range(found->second);
+	for(auto it = range.first; it != range.second; ++it) {
+		if(it->second.id != id) continue;
+		if(--it->second.users == 0) {
+			GLResources::deleteLater(GLResources::Object::Shader, id);
+			cachedShaders.erase(it);
+			cachedShaderHashes.erase(found);
+		}
+		return;
+	}
+}
+
+size_t ShaderCache::size()
+{
+	return cachedShaders.size();
+}
+
+uint64_t ShaderCache::hits()
+{
+	return cacheHits;
+}
+
 ShaderFile::ShaderFile(std::string f) :
 	dependingPrograms(0),
 	fileName(f),
+	source(""),
 	isBuild(false),
 	id(0),
 	shaderType(determineShaderType(f))
@@ -56,7 +181,9 @@ bool ShaderFile::addDependingProgram(ShaderProgram* P)
 
 bool ShaderFile::reload()
 {
+	PROFILE_CPU_ZONE("ShaderFile::reload");
 	clean();
+	source = "";
 	// Open the file
 	std::ifstream In;
 	In.open(fileName);
@@ -71,29 +198,10 @@ bool ShaderFile::reload()
 			fileContent.append(line).append("\n");
 		}
 		In.close();
-		// Create a shader
-		id = glCreateShader(shaderType);
-		// Compile
-		const char* fileContentChar = fileContent.c_str();
-		glShaderSource(id, 1, &fileContentChar, NULL);
-		glCompileShader(id);
-		// Check if compiling was successful
-		GLint isCompiled = 0;
-		glGetShaderiv(id, GL_COMPILE_STATUS, &isCompiled);
-		if(isCompiled == GL_FALSE) {
-			printf("Error: Can't compile %s\n", fileName.c_str());
-			printf("Code:\n%s\n", fileContentChar);
-			// Print the info log for the sahder
-			GLint maxLength = 0;
-			glGetShaderiv(id, GL_INFO_LOG_LENGTH, &maxLength);
-			std::vector<GLchar> errorLog(maxLength);
-			glGetShaderInfoLog(id, maxLength, &maxLength, &errorLog[0]);
-			for(GLchar c : errorLog)
-				printf("%c", (char) c);
-			printf("\n");
-			// Delete the shader
-			glDeleteShader(id);
-		} else {
+		source = fileContent;
+		// Create and compile the shader
+		id = compileShaderSource(shaderType, fileContent, fileName.c_str());
+		if(id != 0) {
 			// No issues, this is now safe to use
 			isBuild = true;
 			return true;
@@ -103,6 +211,26 @@ bool ShaderFile::reload()
 	return false;
 }
 
+std::string ShaderFile::expandVariant(const std::string& defines) const
+{
+	// The defines have to follow the #version line
+	size_t pos = 0;
+	unsigned int line = 1;
+	while(pos < source.size()) {
+		size_t end = source.find('\n', pos);
+		if(end == std::string::npos) end = source.size();
+		size_t first = source.find_first_not_of(" \t", pos);
+		bool isVersion = (first < end) && (source.compare(first, 8, "#version") == 0);
+		pos = end + 1;
+		line++;
+		if(isVersion) {
+			// Keep the line numbers of error messages right
+			return source.substr(0, pos) + defines + "#line " + std::to_string(line) + "\n" + source.substr(std::min(pos, source.size()));
+		}
+	}
+	return defines + "#line 1\n" + source;
+}
+
 void ShaderFile::clean()
 {
 	if(!isBuild) return;
@@ -110,8 +238,8 @@ void ShaderFile::clean()
 	for(ShaderProgram* p : dependingPrograms) {
 		p->clean();
 	}
-	// Delete this shader
-	glDeleteShader(id);
+	// Delete this shader once no frame uses it
+	GLResources::deleteLater(GLResources::Object::Shader, id);
 	// Mark as not build
 	isBuild = false;
 }
@@ -126,6 +254,9 @@ ShaderProgram::ShaderProgram(SimpleShaderInfo& info) :
 ShaderProgram::~ShaderProgram()
 {
 	clean();
+	for(std::pair<const VariantKey, Variant>& V : variants) {
+		cleanVariant(V.second);
+	}
 }
 
 bool ShaderProgram::appendShader(ShaderFile* F)
@@ -140,18 +271,23 @@ bool ShaderProgram::appendShader(ShaderFile* F)
 
 void ShaderProgram::clean()
 {
+	// Variants depend on the same files
+	for(std::pair<const VariantKey, Variant>& V : variants) {
+		cleanVariant(V.second);
+	}
 	if(!isBuild) return;
 	// Mark as unusable
 	shaderInfo.useable = false;
 	// Delete from graphics card
 	// Detaching ?
 	//...
-	glDeleteProgram(id);
+	GLResources::deleteLater(GLResources::Object::Program, id);
 	isBuild = false;
 }
 
 bool ShaderProgram::reload()
 {
+	PROFILE_CPU_ZONE("ShaderProgram::reload");
 	clean();
 	// Check if we can build this
 	for(ShaderFile* S : dependencies) {
@@ -165,5 +301,104 @@ bool ShaderProgram::reload()
 	glLinkProgram(id);
 	shaderInfo.id = id;
 	shaderInfo.useable = true;
+	isBuild = true;
+	// Rebuild every variant that has been used before
+	for(std::pair<const VariantKey, Variant>& V : variants) {
+		V.second.failed = false;
+		buildVariant(V.first, V.second);
+	}
 	return true;
 }
+
+VariantKey ShaderProgram::addDefine(const std::string& define)
+{
+	VariantKey existing = getDefine(define);
+	if(existing) return existing;
+	if(defines.size() == MAX_DEFINES) {
+		throw std::invalid_argument("Too many defines for a shader program, the limit is 64\n");
+	}
+	defines.push_back(define);
+	return ((VariantKey) 1) << (defines.size() - 1);
+}
+
+VariantKey ShaderProgram::getDefine(const std::string& define) const
+{
+	for(unsigned int i = 0; i < defines.size(); i++) {
+		if(defines[i] == define) return ((VariantKey) 1) << i;
+	}
+	return 0;
+}
+
+const SimpleShaderInfo* ShaderProgram::variant(VariantKey key)
+{
+	if(key == 0) return &shaderInfo;
+	std::unordered_map<VariantKey, Variant>::iterator it = variants.find(key);
+	if(it == variants.end()) it = variants.emplace(key, Variant()).first;
+	Variant& V = it->second;
+	if(!V.built && !V.failed) buildVariant(key, V);
+	return &V.info;
+}
+
+bool ShaderProgram::isVariantBuilt(VariantKey key) const
+{
+	if(key == 0) return isBuild;
+	std::unordered_map<VariantKey, Variant>::const_iterator it = variants.find(key);
+	return (it != variants.end()) && it->second.built;
+}
+
+std::vector<VariantKey> ShaderProgram::builtVariants() const
+{
+	std::vector<VariantKey> R;
+	if(isBuild) R.push_back(0);
+	for(const std::pair<const VariantKey, Variant>& V : variants) {
+		if(V.second.built) R.push_back(V.first);
+	}
+	return R;
+}
+
+bool ShaderProgram::buildVariant(VariantKey key, Variant& V)
+{
+	PROFILE_CPU_ZONE("ShaderProgram::buildVariant");
+	cleanVariant(V);
+	std::string block = "";
+	for(unsigned int i = 0; i < defines.size(); i++) {
+		if(key & (((VariantKey) 1) << i)) block += "#define " + defines[i] + "\n";
+	}
+	for(ShaderFile* f : dependencies) {
+		unsigned int shader = f->hasSource() ? ShaderCache::acquire(f->getType(), f->expandVariant(block), f->getFileName().c_str()) : 0;
+		if(shader == 0) {
+			cleanVariant(V);
+			V.failed = true;
+			return false;
+		}
+		V.shaders.push_back(shader);
+	}
+	V.info.id = glCreateProgram();
+	for(unsigned int shader : V.shaders) {
+		glAttachShader(V.info.id, shader);
+	}
+	glLinkProgram(V.info.id);
+	GLint isLinked = 0;
+	glGetProgramiv(V.info.id, GL_LINK_STATUS, &isLinked);
+	if(isLinked == GL_FALSE) {
+		printf("Error: Can't link a variant of a shader program\n");
+		cleanVariant(V);
+		V.failed = true;
+		return false;
+	}
+	V.info.useable = true;
+	V.built = true;
+	return true;
+}
+
+void ShaderProgram::cleanVariant(Variant& V)
+{
+	GLResources::deleteLater(GLResources::Object::Program, V.info.id);
+	for(unsigned int shader : V.shaders) {
+		ShaderCache::release(shader);
+	}
+	V.shaders.clear();
+	V.info.id = 0;
+	V.info.useable = false;
+	V.built = false;
+}
@@ -1,7 +1,9 @@
 #ifndef SHADERS_H_DEFINED
 #define SHADERS_H_DEFINED
 
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <GLInclude.h>
@@ -20,12 +22,37 @@ struct SimpleShaderInfo {
 	// as a shortcut for applying
 	// postProcessing shaders
 	bool applyPostProcessing() const;
+	// Like use() but also dispatch compute work groups
+	// Memory barriers are left to the caller
+	bool dispatchCompute(unsigned int x, unsigned int y = 1, unsigned int z = 1) const;
 };
 
+// Compile a shader from source, returns 0 and prints
+// the info log if compiling fails
+unsigned int compileShaderSource(GLenum type, const std::string& source, const char* name);
+
+// Compiled shaders shared between all identical sources
+// Sources are looked up by a hash, so every variant of every file
+// is only compiled once no matter how many programs use it.
+namespace ShaderCache {
+	// Compile the source or take the cached shader, returns 0 on failure
+	unsigned int acquire(GLenum type, const std::string& source, const char* name);
+	// Delete the shader once the last user released it
+	void release(unsigned int id);
+	// Number of cached shaders and of lookups that found one
+	size_t size();
+	uint64_t hits();
+}; // namespace ShaderCache
+
+// Bit i is set if the i-th define of a program is enabled
+typedef uint64_t VariantKey;
+
 class ShaderFile {
   private:
 	std::vector<ShaderProgram*> dependingPrograms;
 	std::string fileName;
+	// Content of the file, kept for building variants
+	std::string source;
 	bool isBuild;
 	unsigned int id;
 	GLenum shaderType;
@@ -38,16 +65,41 @@ class ShaderFile {
 	void clean();
 	inline bool isShaderBuild() { return isBuild; };
 	inline unsigned int getId() { return id; };
+	inline GLenum getType() const { return shaderType; };
+	inline const std::string& getFileName() const { return fileName; };
+	inline bool hasSource() const { return source.size() > 0; };
+	// The source with the defines inserted after the #version line
+	std::string expandVariant(const std::string& defines) const;
 };
 
+// A program and its variants
+// Variants are the same files compiled with a set of #defines,
+// selected by a VariantKey. Every variant is built the first time
+// it is requested and rebuilt on reload once it has been used.
 class ShaderProgram {
   private:
+	struct Variant {
+		SimpleShaderInfo info;
+		// Shaders taken from the ShaderCache
+		std::vector<unsigned int> shaders;
+		bool built = false;
+		// Don't retry a broken variant every frame
+		bool failed = false;
+	};
 	std::vector<ShaderFile*> dependencies;
 	bool isBuild;
 	SimpleShaderInfo& shaderInfo;
 	unsigned int id;
+	// Everything after #define, one per bit of the keys
+	std::vector<std::string> defines;
+	// Element pointers stay valid when the map grows
+	std::unordered_map<VariantKey, Variant> variants;
+	bool buildVariant(VariantKey key, Variant& V);
+	void cleanVariant(Variant& V);
 
   public:
+	// Maximum number of defines per program
+	static constexpr unsigned int MAX_DEFINES = 64;
 	ShaderProgram(SimpleShaderInfo& info);
 	~ShaderProgram();
 	bool appendShader(ShaderFile* F);
@@ -55,6 +107,18 @@ class ShaderProgram {
 	bool reload();
 	inline bool isProgramBuild() { return isBuild; };
 	inline unsigned int getId() { return id; };
+	// Register a define, e.g. "USE_SHADOWS" or "LIGHT_COUNT 4"
+	// and get the bit to enable it in a key
+	VariantKey addDefine(const std::string& define);
+	// The bit of a registered define, 0 if it doesn't exist
+	VariantKey getDefine(const std::string& define) const;
+	// The shader for a combination of defines, built on first use
+	// Key 0 is the program without any defines. The pointer stays valid
+	// for the lifetime of the program, check useable before drawing.
+	const SimpleShaderInfo* variant(VariantKey key);
+	bool isVariantBuilt(VariantKey key) const;
+	// Keys of all variants that are built right now
+	std::vector<VariantKey> builtVariants() const;
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include "GLHelper.h"
 
 #include <algorithm>
+#include <cstring>
 
 void GLHelper::setTextureParameters(GLenum filter, GLenum wrap)
 {
@@ -21,3 +22,32 @@ void GLHelper::flipImageY(unsigned char* pixels, unsigned int width, unsigned in
 			pixels + (height - i - 1) * len);
 	}
 }
+
+bool GLHelper::hasVersion(int major, int minor)
+{
+	static GLint version[2] = {-1, -1};
+	if(version[0] < 0) {
+		glGetIntegerv(GL_MAJOR_VERSION, &version[0]);
+		glGetIntegerv(GL_MINOR_VERSION, &version[1]);
+	}
+	return (version[0] > major) || ((version[0] == major) && (version[1] >= minor));
+}
+
+bool GLHelper::hasExtension(const char* name)
+{
+	GLint extensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+	for(GLint i = 0; i < extensions; i++) {
+		const char* e = (const char*) glGetStringi(GL_EXTENSIONS, i);
+		if(e && !strcmp(e, name)) return true;
+	}
+	return false;
+}
+
+void GLHelper::copyImageFlippedY(const unsigned char* source, unsigned char* destination, unsigned int width, unsigned int height)
+{
+	size_t len = (size_t) width << 2;
+	for(unsigned int i = 0; i < height; i++) {
+		std::copy(source + i * len, source + (i + 1) * len, destination + (height - i - 1) * len);
+	}
+}
@@ -8,6 +8,12 @@ namespace GLHelper {
 	void setTextureParameters(GLenum filter, GLenum wrap);
 	// Flip an image vertically
 	void flipImageY(unsigned char* pixels, unsigned int width, unsigned int height);
+	// Copy an image and flip it vertically in the same pass
+	void copyImageFlippedY(const unsigned char* source, unsigned char* destination, unsigned int width, unsigned int height);
+	// Whether the current context is at least the given version
+	// The version is queried once, all contexts are assumed to be alike.
+	bool hasVersion(int major, int minor);
+	bool hasExtension(const char* name);
 }; // namespace GLHelper
 
 #endif
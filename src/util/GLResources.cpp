@@ -0,0 +1,279 @@
+#include "GLResources.h"
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "MemoryStats.h"
+#include "Profiler.h"
+
+using namespace GLResources;
+
+namespace {
+	struct BufferInfo {
+		size_t capacity;
+		size_t requested;
+		GLenum usage;
+	};
+
+	struct Retired {
+		Object type;
+		unsigned int id;
+		// Goes back into a pool instead of being deleted
+		bool pooled;
+	};
+
+	struct Frame {
+		GLsync fence;
+		std::vector<Retired> objects;
+	};
+
+	// Smallest buffer size class
+	constexpr size_t MIN_BUFFER_SIZE = 256;
+
+	// Buffers handed out by acquireBuffer
+	std::unordered_map<unsigned int, BufferInfo> liveBuffers;
+	// Idle buffers by size class and usage
+	std::unordered_map<uint64_t, std::vector<unsigned int>> bufferPool;
+	std::vector<unsigned int> vertexArrayPool;
+	// Released since the last endFrame()
+	std::vector<Retired> currentFrame;
+	// Oldest first, so fences are checked in order
+	std::deque<Frame> frames;
+	bool framesStarted = false;
+	int64_t bufferBudget = 64ll << 20;
+	unsigned int vertexArrayBudget = 1024;
+	GLint maxVertexAttribs = -1;
+	Statistics stats;
+
+	// Four size classes per power of two waste at most 25%
+	size_t sizeClass(size_t bytes)
+	{
+		if(bytes <= MIN_BUFFER_SIZE) return MIN_BUFFER_SIZE;
+		size_t power = MIN_BUFFER_SIZE;
+		while(power * 2 < bytes)
+			power *= 2;
+		size_t step = power / 4;
+		return (bytes + step - 1) / step * step;
+	}
+
+	uint64_t poolKey(size_t capacity, GLenum usage)
+	{
+		return ((uint64_t) capacity << 16) | (usage & 0xffff);
+	}
+
+	void deleteNow(Object type, unsigned int id)
+	{
+		switch(type) {
+			case Object::Buffer: glDeleteBuffers(1, &id); break;
+			case Object::VertexArray: glDeleteVertexArrays(1, &id); break;
+			case Object::Texture: glDeleteTextures(1, &id); break;
+			case Object::Framebuffer: glDeleteFramebuffers(1, &id); break;
+			case Object::Renderbuffer: glDeleteRenderbuffers(1, &id); break;
+			case Object::Shader: glDeleteShader(id); break;
+			case Object::Program: glDeleteProgram(id); break;
+		}
+	}
+
+	void poolBuffer(unsigned int id)
+	{
+		std::unordered_map<unsigned int, BufferInfo>::iterator it = liveBuffers.find(id);
+		// Released twice
+		if(it == liveBuffers.end()) return;
+		const BufferInfo B = it->second;
+		liveBuffers.erase(it);
+		stats.liveBufferBytes -= B.capacity;
+		stats.requestedBufferBytes -= B.requested;
+		if(stats.pooledBufferBytes + (int64_t) B.capacity > bufferBudget) {
+			glDeleteBuffers(1, &id);
+			return;
+		}
+		bufferPool[poolKey(B.capacity, B.usage)].push_back(id);
+		stats.pooledBuffers++;
+		stats.pooledBufferBytes += B.capacity;
+		MemoryStats::allocate(MemoryStats::Category::PooledBuffer, B.capacity);
+	}
+
+	void retire(const Retired& R)
+	{
+		if(!R.pooled) {
+			deleteNow(R.type, R.id);
+		} else if(R.type == Object::Buffer) {
+			poolBuffer(R.id);
+		} else if(vertexArrayPool.size() < vertexArrayBudget) {
+			vertexArrayPool.push_back(R.id);
+		} else {
+			glDeleteVertexArrays(1, &R.id);
+		}
+	}
+
+	void queue(const Retired& R)
+	{
+		if(!framesStarted) {
+			retire(R);
+			return;
+		}
+		currentFrame.push_back(R);
+		stats.deferredDeletions++;
+	}
+
+	void retireFrame(Frame& F)
+	{
+		glDeleteSync(F.fence);
+		for(const Retired& R : F.objects)
+			retire(R);
+	}
+} // namespace
+
+void GLResources::deleteLater(Object type, unsigned int id)
+{
+	if(id == 0) return;
+	queue({type, id, false});
+}
+
+unsigned int GLResources::acquireBuffer(GLenum target, size_t bytes, GLenum usage)
+{
+	const size_t capacity = sizeClass(bytes);
+	unsigned int id = 0;
+	stats.bufferRequests++;
+	std::unordered_map<uint64_t, std::vector<unsigned int>>::iterator it = bufferPool.find(poolKey(capacity, usage));
+	if((it != bufferPool.end()) && !it->second.empty()) {
+		id = it->second.back();
+		it->second.pop_back();
+		stats.bufferReuses++;
+		stats.pooledBuffers--;
+		stats.pooledBufferBytes -= capacity;
+		MemoryStats::release(MemoryStats::Category::PooledBuffer, capacity);
+		glBindBuffer(target, id);
+	} else {
+		glGenBuffers(1, &id);
+		glBindBuffer(target, id);
+		glBufferData(target, capacity, nullptr, usage);
+	}
+	PROFILE_COUNT_BINDS(1);
+	liveBuffers[id] = {capacity, bytes, usage};
+	stats.liveBufferBytes += capacity;
+	stats.requestedBufferBytes += bytes;
+	return id;
+}
+
+void GLResources::releaseBuffer(unsigned int id)
+{
+	if(id == 0) return;
+	// Not one of ours, just delete it
+	queue({Object::Buffer, id, liveBuffers.count(id) > 0});
+}
+
+unsigned int GLResources::acquireVertexArray()
+{
+	unsigned int id = 0;
+	stats.vertexArrayRequests++;
+	if(vertexArrayPool.empty()) {
+		glGenVertexArrays(1, &id);
+		glBindVertexArray(id);
+		return id;
+	}
+	id = vertexArrayPool.back();
+	vertexArrayPool.pop_back();
+	stats.vertexArrayReuses++;
+	// Back to the default state, divisors included since
+	// they would otherwise survive enabling an attribute again
+	if(maxVertexAttribs < 0) glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &maxVertexAttribs);
+	glBindVertexArray(id);
+	for(GLint i = 0; i < maxVertexAttribs; i++) {
+		glDisableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 0);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	return id;
+}
+
+void GLResources::releaseVertexArray(unsigned int id)
+{
+	if(id == 0) return;
+	queue({Object::VertexArray, id, true});
+}
+
+void GLResources::endFrame()
+{
+	PROFILE_CPU_ZONE("GLResources::endFrame");
+	framesStarted = true;
+	if(!currentFrame.empty()) {
+		frames.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), std::move(currentFrame)});
+		currentFrame.clear();
+	}
+	// Fences are signaled in order, stop at the first busy one
+	while(!frames.empty()) {
+		GLenum result = glClientWaitSync(frames.front().fence, 0, 0);
+		if(result == GL_TIMEOUT_EXPIRED) break;
+		if(result == GL_WAIT_FAILED) printf("Error: Waiting for a frame fence failed\n");
+		retireFrame(frames.front());
+		frames.pop_front();
+	}
+}
+
+void GLResources::setPoolBudget(int64_t bufferBytes, unsigned int vertexArrays)
+{
+	bufferBudget = bufferBytes;
+	vertexArrayBudget = vertexArrays;
+}
+
+void GLResources::clear()
+{
+	glFinish();
+	for(Frame& F : frames)
+		retireFrame(F);
+	frames.clear();
+	for(const Retired& R : currentFrame)
+		retire(R);
+	currentFrame.clear();
+	for(std::pair<const uint64_t, std::vector<unsigned int>>& P : bufferPool) {
+		const int64_t capacity = P.first >> 16;
+		for(unsigned int id : P.second) {
+			glDeleteBuffers(1, &id);
+			MemoryStats::release(MemoryStats::Category::PooledBuffer, capacity);
+		}
+	}
+	bufferPool.clear();
+	if(!vertexArrayPool.empty()) glDeleteVertexArrays(vertexArrayPool.size(), &vertexArrayPool[0]);
+	vertexArrayPool.clear();
+	stats.pooledBuffers = 0;
+	stats.pooledBufferBytes = 0;
+	framesStarted = false;
+}
+
+Statistics GLResources::statistics()
+{
+	Statistics S = stats;
+	S.pendingObjects = currentFrame.size();
+	for(const Frame& F : frames)
+		S.pendingObjects += F.objects.size();
+	S.pendingFrames = frames.size();
+	S.pooledVertexArrays = vertexArrayPool.size();
+	return S;
+}
+
+void GLResources::resetStatistics()
+{
+	stats.bufferRequests = 0;
+	stats.bufferReuses = 0;
+	stats.vertexArrayRequests = 0;
+	stats.vertexArrayReuses = 0;
+	stats.deferredDeletions = 0;
+}
+
+std::string GLResources::report()
+{
+	Statistics S = statistics();
+	char buffer[512];
+	snprintf(buffer, sizeof(buffer),
+			 "Buffers        %llu requests, %.1f%% reused, %llu pooled (%.2f MiB)\n"
+			 "Vertex arrays  %llu requests, %.1f%% reused, %llu pooled\n"
+			 "In use         %.2f MiB of pooled buffers, %.2f MiB requested\n"
+			 "Deferred       %llu deletions, %llu objects in %llu frames pending\n",
+			 (unsigned long long) S.bufferRequests, S.bufferReuseRate() * 100, (unsigned long long) S.pooledBuffers, S.pooledBufferBytes / 1048576.0,
+			 (unsigned long long) S.vertexArrayRequests, S.vertexArrayReuseRate() * 100, (unsigned long long) S.pooledVertexArrays,
+			 S.liveBufferBytes / 1048576.0, S.requestedBufferBytes / 1048576.0,
+			 (unsigned long long) S.deferredDeletions, (unsigned long long) S.pendingObjects, (unsigned long long) S.pendingFrames);
+	return buffer;
+}
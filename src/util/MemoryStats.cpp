@@ -0,0 +1,143 @@
+#include "MemoryStats.h"
+
+#include <algorithm>
+#include <atomic>
+
+using namespace MemoryStats;
+
+namespace {
+	constexpr unsigned int CATEGORIES = (unsigned int) Category::Count;
+
+	std::atomic<int64_t> current[CATEGORIES];
+	std::atomic<int64_t> peak[CATEGORIES];
+	std::atomic<int64_t> live[CATEGORIES];
+
+	bool isGpu(Category c)
+	{
+		return c < Category::CpuVertices;
+	}
+
+	void add(Category c, int64_t bytes)
+	{
+		unsigned int i = (unsigned int) c;
+		int64_t now = current[i].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+		int64_t p = peak[i].load(std::memory_order_relaxed);
+		while((now > p) && !peak[i].compare_exchange_weak(p, now, std::memory_order_relaxed)) {}
+	}
+
+	std::string formatBytes(int64_t bytes)
+	{
+		char buffer[32];
+		const char* units[] = {"B", "KiB", "MiB", "GiB"};
+		double b = bytes;
+		int u = 0;
+		while(((b >= 1024) || (b <= -1024)) && (u < 3)) {
+			b /= 1024;
+			u++;
+		}
+		snprintf(buffer, sizeof(buffer), "%.2f %s", b, units[u]);
+		return buffer;
+	}
+} // namespace
+
+const char* MemoryStats::categoryName(Category c)
+{
+	switch(c) {
+		case Category::VertexBuffer: return "GPU vertex buffers";
+		case Category::IndexBuffer: return "GPU index buffers";
+		case Category::InstanceBuffer: return "GPU instance buffers";
+		case Category::UniformBuffer: return "GPU uniform buffers";
+		case Category::StorageBuffer: return "GPU storage buffers";
+		case Category::PixelBuffer: return "GPU pixel buffers";
+		case Category::PooledBuffer: return "GPU pooled buffers";
+		case Category::Texture: return "GPU textures";
+		case Category::CpuVertices: return "CPU vertex data";
+		case Category::CpuIndices: return "CPU index data";
+		case Category::CpuTracker: return "CPU vertex tracker";
+		case Category::CpuInstances: return "CPU instance data";
+		case Category::Count: break;
+	}
+	return "Unknown";
+}
+
+void MemoryStats::allocate(Category c, int64_t bytes)
+{
+	live[(unsigned int) c].fetch_add(1, std::memory_order_relaxed);
+	add(c, bytes);
+}
+
+void MemoryStats::release(Category c, int64_t bytes)
+{
+	live[(unsigned int) c].fetch_sub(1, std::memory_order_relaxed);
+	add(c, -bytes);
+}
+
+void MemoryStats::resize(Category c, int64_t oldBytes, int64_t newBytes)
+{
+	if(oldBytes == newBytes) return;
+	add(c, newBytes - oldBytes);
+}
+
+Usage MemoryStats::get(Category c)
+{
+	unsigned int i = (unsigned int) c;
+	Usage U;
+	U.bytes = current[i].load(std::memory_order_relaxed);
+	U.peakBytes = peak[i].load(std::memory_order_relaxed);
+	U.allocations = live[i].load(std::memory_order_relaxed);
+	return U;
+}
+
+int64_t MemoryStats::gpuBytes()
+{
+	int64_t s = 0;
+	for(unsigned int i = 0; i < CATEGORIES; i++) {
+		if(isGpu((Category) i)) s += current[i].load(std::memory_order_relaxed);
+	}
+	return s;
+}
+
+int64_t MemoryStats::cpuBytes()
+{
+	int64_t s = 0;
+	for(unsigned int i = 0; i < CATEGORIES; i++) {
+		if(!isGpu((Category) i)) s += current[i].load(std::memory_order_relaxed);
+	}
+	return s;
+}
+
+void MemoryStats::resetPeaks()
+{
+	for(unsigned int i = 0; i < CATEGORIES; i++) {
+		peak[i].store(current[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+}
+
+std::string MemoryStats::report()
+{
+	std::string R;
+	char line[160];
+	snprintf(line, sizeof(line), "%-24s %14s %14s %12s\n", "Category", "Current", "Peak", "Allocations");
+	R += line;
+	for(unsigned int i = 0; i < CATEGORIES; i++) {
+		Usage U = get((Category) i);
+		snprintf(line, sizeof(line), "%-24s %14s %14s %12lld\n", categoryName((Category) i),
+				 formatBytes(U.bytes).c_str(), formatBytes(U.peakBytes).c_str(), (long long) U.allocations);
+		R += line;
+	}
+	snprintf(line, sizeof(line), "%-24s %14s\n%-24s %14s\n", "Total GPU", formatBytes(gpuBytes()).c_str(),
+			 "Total CPU", formatBytes(cpuBytes()).c_str());
+	R += line;
+	return R;
+}
+
+int64_t MemoryStats::textureBytes(unsigned int width, unsigned int height, unsigned int bytesPerPixel, bool mipmaps)
+{
+	int64_t s = (int64_t) width * height * bytesPerPixel;
+	while(mipmaps && ((width > 1) || (height > 1))) {
+		width = std::max(1u, width >> 1);
+		height = std::max(1u, height >> 1);
+		s += (int64_t) width * height * bytesPerPixel;
+	}
+	return s;
+}
@@ -0,0 +1,55 @@
+#ifndef MEMORY_STATS_H_DEFINED
+#define MEMORY_STATS_H_DEFINED
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Global accounting of graphics and mirrored CPU memory
+// Objects report what they allocate and release, the registry keeps
+// the current size, the high-water mark and the number of live
+// allocations per category. All functions are thread safe.
+namespace MemoryStats {
+	enum class Category {
+		VertexBuffer,
+		IndexBuffer,
+		InstanceBuffer,
+		UniformBuffer,
+		StorageBuffer,
+		PixelBuffer,
+		// Idle buffers kept by GLResources
+		PooledBuffer,
+		Texture,
+		CpuVertices,
+		CpuIndices,
+		CpuTracker,
+		CpuInstances,
+		Count
+	};
+
+	struct Usage {
+		int64_t bytes = 0;
+		int64_t peakBytes = 0;
+		int64_t allocations = 0;
+	};
+
+	const char* categoryName(Category c);
+	// Record a new allocation or a release
+	void allocate(Category c, int64_t bytes);
+	void release(Category c, int64_t bytes);
+	// Change the size of an existing allocation
+	void resize(Category c, int64_t oldBytes, int64_t newBytes);
+	Usage get(Category c);
+	// Sums over all GPU or all CPU categories
+	int64_t gpuBytes();
+	int64_t cpuBytes();
+	// Set the high-water marks to the current values
+	void resetPeaks();
+	// Table of all categories
+	std::string report();
+	inline void print(FILE* f = stdout) { fputs(report().c_str(), f); };
+	// Size of a texture, including all mip levels if requested
+	int64_t textureBytes(unsigned int width, unsigned int height, unsigned int bytesPerPixel, bool mipmaps);
+}; // namespace MemoryStats
+
+#endif
@@ -0,0 +1,249 @@
+#include "Profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace {
+	struct TraceEvent {
+		const char* name;
+		const char* category;
+		// 'X' for complete events and 'C' for counters
+		char phase;
+		uint32_t tid;
+		int64_t start;
+		int64_t duration;
+		Profiler::FrameCounters counters;
+	};
+
+	// A pair of timestamp queries for a GPU zone
+	struct GpuQuery {
+		const char* name;
+		unsigned int begin;
+		unsigned int end;
+		// False until the end timestamp was issued
+		bool closed;
+	};
+
+	// All GPU queries issued during one frame
+	// The queries are kept and reused once the slot comes around again
+	struct FrameSlot {
+		std::vector<unsigned int> queryPool;
+		size_t usedQueries = 0;
+		std::vector<GpuQuery> zones;
+	};
+
+	// The GPU gets its own row in the trace
+	constexpr uint32_t GPU_THREAD_ID = 0;
+
+	std::mutex eventMutex;
+	std::vector<TraceEvent> events;
+	size_t maxEvents = 1 << 20;
+	std::atomic<size_t> droppedEvents(0);
+
+	FrameSlot slots[Profiler::QUERY_FRAME_LATENCY];
+	unsigned int frameIndex = 0;
+	// Counts beginFrame() calls, unlike frameIndex it also
+	// changes when a frame is restarted after setEnabled()
+	unsigned int frameNumber = 0;
+	bool inFrame = false;
+	int64_t frameStart = 0;
+	// GPU timestamp minus CPU time in nanoseconds
+	int64_t gpuClockOffset = 0;
+	Profiler::FrameCounters finishedCounters;
+
+	const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+	std::atomic<uint32_t> nextThreadId(1);
+	thread_local uint32_t threadId = nextThreadId++;
+
+	int64_t nowNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count();
+	}
+
+	void pushEvent(const TraceEvent& e)
+	{
+		std::lock_guard<std::mutex> lock(eventMutex);
+		if(events.size() >= maxEvents) {
+			droppedEvents++;
+			return;
+		}
+		events.push_back(e);
+	}
+
+	unsigned int acquireQuery(FrameSlot& s)
+	{
+		if(s.usedQueries == s.queryPool.size()) {
+			unsigned int q;
+			glGenQueries(1, &q);
+			s.queryPool.push_back(q);
+		}
+		return s.queryPool[s.usedQueries++];
+	}
+
+	// Read back the queries of a slot without waiting for them
+	// Zones that are not finished yet are dropped
+	void resolveSlot(FrameSlot& s)
+	{
+		for(const GpuQuery& z : s.zones) {
+			if(!z.closed) {
+				droppedEvents++;
+				continue;
+			}
+			GLint available = 0;
+			glGetQueryObjectiv(z.end, GL_QUERY_RESULT_AVAILABLE, &available);
+			if(!available) {
+				droppedEvents++;
+				continue;
+			}
+			GLuint64 begin = 0;
+			GLuint64 end = 0;
+			glGetQueryObjectui64v(z.begin, GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(z.end, GL_QUERY_RESULT, &end);
+			pushEvent({z.name, "gpu", 'X', GPU_THREAD_ID,
+					   (int64_t) begin - gpuClockOffset, (int64_t) (end - begin), {}});
+		}
+		s.zones.clear();
+		s.usedQueries = 0;
+	}
+
+	void writeEscaped(FILE* f, const char* s)
+	{
+		for(; *s; s++) {
+			if((*s == '"') || (*s == '\\')) fputc('\\', f);
+			if((unsigned char) *s < 0x20) continue;
+			fputc(*s, f);
+		}
+	}
+} // namespace
+
+bool Profiler::enabledFlag = false;
+Profiler::FrameCounters Profiler::currentCounters;
+
+void Profiler::setEnabled(bool enable)
+{
+	if(enable == enabledFlag) return;
+	if(enable) {
+		// Calibrate the GPU clock against the CPU clock
+		GLint64 gpuTime = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+		gpuClockOffset = gpuTime - nowNs();
+	} else {
+		// Forget about queries that are still in flight
+		for(FrameSlot& s : slots) {
+			s.zones.clear();
+			s.usedQueries = 0;
+		}
+		inFrame = false;
+	}
+	enabledFlag = enable;
+}
+
+void Profiler::beginFrame()
+{
+	if(!enabledFlag) return;
+	// The slot we are about to reuse was last
+	// filled QUERY_FRAME_LATENCY frames ago
+	resolveSlot(slots[frameIndex % QUERY_FRAME_LATENCY]);
+	currentCounters = FrameCounters();
+	frameNumber++;
+	frameStart = nowNs();
+	inFrame = true;
+}
+
+void Profiler::endFrame()
+{
+	if(!enabledFlag || !inFrame) return;
+	int64_t end = nowNs();
+	pushEvent({"Frame", "frame", 'X', threadId, frameStart, end - frameStart, {}});
+	pushEvent({"Frame counters", "frame", 'C', threadId, end, 0, currentCounters});
+	finishedCounters = currentCounters;
+	frameIndex++;
+	inFrame = false;
+}
+
+const Profiler::FrameCounters& Profiler::lastFrame()
+{
+	return finishedCounters;
+}
+
+Profiler::CpuZone::CpuZone(const char* name_) :
+	name(name_),
+	start(enabledFlag ? nowNs() : -1)
+{}
+
+Profiler::CpuZone::~CpuZone()
+{
+	if(start < 0 || !enabledFlag) return;
+	pushEvent({name, "cpu", 'X', threadId, start, nowNs() - start, {}});
+}
+
+Profiler::GpuZone::GpuZone(const char* name_) :
+	name(name_),
+	frame(frameNumber),
+	zone(-1)
+{
+	if(!enabledFlag || !inFrame) return;
+	FrameSlot& s = slots[frameIndex % QUERY_FRAME_LATENCY];
+	GpuQuery z = {name, acquireQuery(s), acquireQuery(s), false};
+	glQueryCounter(z.begin, GL_TIMESTAMP);
+	zone = s.zones.size();
+	s.zones.push_back(z);
+}
+
+Profiler::GpuZone::~GpuZone()
+{
+	// A zone spanning endFrame() has no end timestamp and is dropped
+	// when its slot is resolved, frameIndex may point to another slot now
+	if(zone < 0 || !enabledFlag || !inFrame || frame != frameNumber) return;
+	GpuQuery& z = slots[frameIndex % QUERY_FRAME_LATENCY].zones[zone];
+	glQueryCounter(z.end, GL_TIMESTAMP);
+	z.closed = true;
+}
+
+void Profiler::setMaxEvents(size_t maxEvents_)
+{
+	std::lock_guard<std::mutex> lock(eventMutex);
+	maxEvents = maxEvents_;
+}
+
+void Profiler::clearTrace()
+{
+	std::lock_guard<std::mutex> lock(eventMutex);
+	events.clear();
+	droppedEvents = 0;
+}
+
+bool Profiler::writeChromeTrace(const std::string& fileName)
+{
+	FILE* f = fopen(fileName.c_str(), "w");
+	if(f == nullptr) {
+		printf("Error: Can't open %s for writing the trace!\n", fileName.c_str());
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(eventMutex);
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", GPU_THREAD_ID);
+	for(const TraceEvent& e : events) {
+		fprintf(f, ",\n{\"name\":\"");
+		writeEscaped(f, e.name);
+		// Chrome traces use microseconds
+		fprintf(f, "\",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+				e.category, e.phase, e.tid, e.start / 1000.0);
+		if(e.phase == 'C') {
+			fprintf(f, ",\"args\":{\"draws\":%llu,\"triangles\":%llu,\"binds\":%llu,\"bytesUploaded\":%llu}}",
+					(unsigned long long) e.counters.draws,
+					(unsigned long long) e.counters.triangles,
+					(unsigned long long) e.counters.binds,
+					(unsigned long long) e.counters.bytesUploaded);
+		} else {
+			fprintf(f, ",\"dur\":%.3f}", e.duration / 1000.0);
+		}
+	}
+	fprintf(f, "\n],\"otherData\":{\"droppedEvents\":%llu}}\n", (unsigned long long) droppedEvents.load());
+	fclose(f);
+	return true;
+}
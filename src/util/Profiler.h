@@ -0,0 +1,114 @@
+#ifndef PROFILER_H_DEFINED
+#define PROFILER_H_DEFINED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <GLInclude.h>
+
+// Lightweight frame profiler
+// CPU zones are measured with a steady clock, GPU zones with
+// timestamp queries that are kept in a ring over several frames
+// so reading them back never waits for the graphics card.
+// Everything is recorded into one timeline that can be written
+// out in the Chrome trace format (chrome://tracing, Perfetto).
+// While disabled every zone and counter only costs a branch,
+// defining JG_DISABLE_PROFILER removes the macros entirely.
+namespace Profiler {
+	// How many frames GPU queries stay in flight before they are read
+	constexpr unsigned int QUERY_FRAME_LATENCY = 4;
+
+	// Statistics collected for a single frame
+	struct FrameCounters {
+		uint64_t draws = 0;
+		uint64_t triangles = 0;
+		uint64_t binds = 0;
+		uint64_t bytesUploaded = 0;
+	};
+
+	// Do not access directly, use isEnabled()
+	extern bool enabledFlag;
+	extern FrameCounters currentCounters;
+
+	inline bool isEnabled() { return enabledFlag; };
+	// Enabling needs a current context to calibrate the GPU clock
+	void setEnabled(bool enable);
+
+	// Frame boundaries, call these on the context thread
+	void beginFrame();
+	void endFrame();
+	// Counters of the last finished frame
+	const FrameCounters& lastFrame();
+
+	// Counters, only call them from the context thread
+	inline void countDraw(uint64_t triangles)
+	{
+		if(!enabledFlag) return;
+		currentCounters.draws++;
+		currentCounters.triangles += triangles;
+	};
+	inline void countBinds(uint64_t binds)
+	{
+		if(!enabledFlag) return;
+		currentCounters.binds += binds;
+	};
+	inline void countUpload(uint64_t bytes)
+	{
+		if(!enabledFlag) return;
+		currentCounters.bytesUploaded += bytes;
+	};
+
+	// Measures the CPU time until it goes out of scope
+	// The name has to outlive the trace (use string literals)
+	class CpuZone {
+	  private:
+		const char* name;
+		int64_t start;
+
+	  public:
+		CpuZone(const char* name_);
+		~CpuZone();
+	};
+
+	// Measures the GPU time of all commands issued in its scope
+	// Zones may be nested since they use two timestamps instead
+	// of a GL_TIME_ELAPSED query which can not be nested
+	class GpuZone {
+	  private:
+		const char* name;
+		// The frame the zone was opened in, zones outliving it are dropped
+		unsigned int frame;
+		int zone;
+
+	  public:
+		GpuZone(const char* name_);
+		~GpuZone();
+	};
+
+	// Limit the number of stored events, further events are dropped
+	void setMaxEvents(size_t maxEvents);
+	// Remove all recorded events
+	void clearTrace();
+	// Write all recorded events as Chrome trace JSON
+	bool writeChromeTrace(const std::string& fileName);
+}; // namespace Profiler
+
+#define PROFILER_CONCAT_INNER(A, B) A##B
+#define PROFILER_CONCAT(A, B) PROFILER_CONCAT_INNER(A, B)
+
+#ifndef JG_DISABLE_PROFILER
+	#define PROFILE_CPU_ZONE(NAME) Profiler::CpuZone PROFILER_CONCAT(profilerCpuZone_, __LINE__)(NAME)
+	#define PROFILE_GPU_ZONE(NAME) Profiler::GpuZone PROFILER_CONCAT(profilerGpuZone_, __LINE__)(NAME)
+	#define PROFILE_COUNT_DRAW(TRIANGLES) Profiler::countDraw(TRIANGLES)
+	#define PROFILE_COUNT_BINDS(BINDS) Profiler::countBinds(BINDS)
+	#define PROFILE_COUNT_UPLOAD(BYTES) Profiler::countUpload(BYTES)
+#else
+	#define PROFILE_CPU_ZONE(NAME)
+	#define PROFILE_GPU_ZONE(NAME)
+	#define PROFILE_COUNT_DRAW(TRIANGLES)
+	#define PROFILE_COUNT_BINDS(BINDS)
+	#define PROFILE_COUNT_UPLOAD(BYTES)
+#endif
+
+#endif